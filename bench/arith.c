@@ -0,0 +1,15 @@
+// Hand-written equivalent of arith.ml
+#include <stdio.h>
+#include <stdlib.h>
+
+int main(int argc, char *argv[]) {
+    long long n = argc > 1 ? (long long)atof(argv[1]) : 0;
+    double total = 0.0;
+    for (long long i = 0; i < n; i++) {
+        double x = i + 1.0;
+        double y = x * x;
+        total += 1.0 / y + 0.5 / (y * y);
+    }
+    printf("%.6f\n", total);
+    return 0;
+}
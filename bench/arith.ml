@@ -0,0 +1,7 @@
+# Arithmetic chain: sum of 1/x^2 + 0.5/x^4 over x = 1..arg0
+total <- 0.0
+parallel repeat arg0 i sum total
+	x <- i + 1.0
+	y <- x * x
+	total <- 1.0 / y + 0.5 / (y * y)
+print total
@@ -0,0 +1,19 @@
+// Hand-written equivalent of calls.ml
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+
+static int64_t one = 1;
+
+static int64_t increment(int64_t value) { return value + one; }
+static int64_t square(int64_t value) { return value * value; }
+
+int main(int argc, char *argv[]) {
+    int64_t n = argc > 1 ? (int64_t)atof(argv[1]) : 0;
+    int64_t total = 0;
+    for (int64_t i = 0; i < n; i++) {
+        total += square(increment(i)) - square(i);
+    }
+    printf("%" PRId64 "\n", total);
+    return 0;
+}
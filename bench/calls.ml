@@ -0,0 +1,15 @@
+# Call-heavy code in the style of samples/sample08.ml: sum of (i + 1)^2 - i^2 = 2i + 1, so arg0^2
+one <- 1
+#
+function increment value
+	return value + one
+#
+#
+function square value
+	return value * value
+#
+#
+total <- 0
+parallel repeat arg0 i sum total
+	total <- square(increment(i)) - square(i)
+print total
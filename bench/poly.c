@@ -0,0 +1,18 @@
+// Hand-written equivalent of poly.ml
+#include <stdio.h>
+#include <stdlib.h>
+
+static double horner(double x, double a, double b, double c, double d) {
+    return ((a * x + b) * x + c) * x + d;
+}
+
+int main(int argc, char *argv[]) {
+    long long n = argc > 1 ? (long long)atof(argv[1]) : 0;
+    double total = 0.0;
+    for (long long i = 0; i < n; i++) {
+        double x = 1.0 / (i + 1);
+        total += horner(x, 0.25, 0.5, 1.0, 0.0) * x;
+    }
+    printf("%.6f\n", total);
+    return 0;
+}
@@ -0,0 +1,10 @@
+# Horner evaluation through a many-parameter function, sum of p(1/(i+1)) / (i+1)
+function horner x a b c d
+	return ((a * x + b) * x + c) * x + d
+#
+#
+total <- 0.0
+parallel repeat arg0 i sum total
+	x <- 1.0 / (i + 1)
+	total <- horner(x, 0.25, 0.5, 1.0, 0.0) * x
+print total
@@ -0,0 +1,99 @@
+#!/bin/sh
+# Compares the C that runml generates for each bench/<kernel>.ml against the
+# hand-written bench/<kernel>.c. Both are compiled with the same flags and run
+# with the same argument; the report gives the best wall time of several runs,
+# instruction counts (when perf is available) and the ml/C ratios.
+#
+# Usage: bench/run.sh [kernel...]
+# Environment:
+#   CC            C compiler (default cc)
+#   CFLAGS        Flags for both programs (default -std=c11 -O2)
+#   BENCH_N       Iteration count passed as arg0 (default 20000000)
+#   BENCH_REPEAT  Runs per program; the fastest is reported (default 3)
+#   OMP_NUM_THREADS  Threads for parallel repeat (default 1, to compare code quality alone)
+#
+# The report is printed and written to bench_output.txt in the repository root.
+
+set -e
+cd "$(dirname "$0")/.."
+
+CC=${CC:-cc}
+CFLAGS=${CFLAGS:--std=c11 -O2}
+BENCH_N=${BENCH_N:-20000000}
+BENCH_REPEAT=${BENCH_REPEAT:-3}
+OMP_NUM_THREADS=${OMP_NUM_THREADS:-1}
+export OMP_NUM_THREADS
+
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+$CC -std=c11 -Wall -Werror -o "$work/runml" runml.c
+
+# Generated programs with parallel repeat need threads; use OpenMP like runml does when it is available
+thread_flags=-pthread
+if echo 'int main(void) { return 0; }' | $CC -fopenmp -x c -o "$work/probe" - 2>/dev/null; then
+    thread_flags="-pthread -fopenmp"
+fi
+
+perf_available=0
+if command -v perf >/dev/null 2>&1 && perf stat -x, -e instructions true >/dev/null 2>&1; then
+    perf_available=1
+fi
+
+# Prints the fastest wall time in seconds of BENCH_REPEAT runs of a program
+best_time() {
+    best=""
+    run=0
+    while [ "$run" -lt "$BENCH_REPEAT" ]; do
+        start=$(date +%s%N)
+        "$1" "$BENCH_N" >/dev/null
+        end=$(date +%s%N)
+        elapsed=$((end - start))
+        if [ -z "$best" ] || [ "$elapsed" -lt "$best" ]; then
+            best=$elapsed
+        fi
+        run=$((run + 1))
+    done
+    awk -v ns="$best" 'BEGIN { printf "%.4f", ns / 1e9 }'
+}
+
+# Prints the retired instruction count of one run, or n/a without perf
+instructions() {
+    if [ "$perf_available" -eq 1 ]; then
+        perf stat -x, -e instructions "$1" "$BENCH_N" 2>&1 >/dev/null | awk -F, '/instructions/ { print $1; exit }'
+    else
+        echo n/a
+    fi
+}
+
+# Prints a / b with two decimals, or n/a
+ratio() {
+    awk -v a="$1" -v b="$2" 'BEGIN { if (a ~ /^[0-9.]+$/ && b ~ /^[0-9.]+$/ && b > 0) printf "%.2f", a / b; else print "n/a" }'
+}
+
+if [ "$#" -gt 0 ]; then
+    kernels="$*"
+else
+    kernels=$(for f in bench/*.ml; do basename "$f" .ml; done)
+fi
+
+{
+    echo "CC=$CC CFLAGS=$CFLAGS $thread_flags BENCH_N=$BENCH_N OMP_NUM_THREADS=$OMP_NUM_THREADS"
+    printf '%-10s %10s %10s %7s %14s %14s %7s %s\n' kernel ml_s c_s ratio ml_instr c_instr ratio output
+    for kernel in $kernels; do
+        "$work/runml" --emit-c "$work/$kernel.ml.c" "bench/$kernel.ml"
+        $CC $CFLAGS $thread_flags -o "$work/$kernel.ml" "$work/$kernel.ml.c" -lm
+        $CC $CFLAGS $thread_flags -o "$work/$kernel.c" "bench/$kernel.c" -lm
+
+        output=same
+        if [ "$("$work/$kernel.ml" "$BENCH_N")" != "$("$work/$kernel.c" "$BENCH_N")" ]; then
+            output=DIFFERENT
+        fi
+        ml_time=$(best_time "$work/$kernel.ml")
+        c_time=$(best_time "$work/$kernel.c")
+        ml_instructions=$(instructions "$work/$kernel.ml")
+        c_instructions=$(instructions "$work/$kernel.c")
+        printf '%-10s %10s %10s %7s %14s %14s %7s %s\n' "$kernel" "$ml_time" "$c_time" "$(ratio "$ml_time" "$c_time")" \
+            "$ml_instructions" "$c_instructions" "$(ratio "$ml_instructions" "$c_instructions")" "$output"
+    done
+} | tee bench_output.txt
@@ -0,0 +1,30 @@
+#include <stdio.h>
+#include <math.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+double y = 0.0;
+
+double multiply(double a, double b, double c);
+double multiply(double a, double b, double c) {
+double x = (a  *  b)  *  c;
+return x;
+}
+
+double multiply__s12_6_4(void);
+double multiply__s12_6_4(void) {
+const double a = 12;
+(void)a;
+const double b = 6;
+(void)b;
+const double c = 4;
+(void)c;
+double x = (a  *  b)  *  c;
+return x;
+}
+
+int main(int argc, char *argv[]) {
+y = multiply__s12_6_4();
+print(y);
+return 0;
+}
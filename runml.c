@@ -1,6 +1,8 @@
 //  Platform:   Apple
 // Complies with cc -std=c11 -Wall -Werror -o runml runml.c
-// Invoke Trans-complier with ./runml test.ml [-v]
+// Invoke Trans-complier with ./runml [options] test.ml [args...] [-v]
+
+#define _DEFAULT_SOURCE  // Expose POSIX process APIs (fork, waitpid) under -std=c11 on Linux
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -9,16 +11,212 @@
 #include <math.h>
 #include <unistd.h>   // For getpid()
 #include <stdarg.h>   // For variable argument lists
+#include <setjmp.h>   // For resuming after an error in --check mode
+#include <stdint.h>
+#include <inttypes.h>
+#include <time.h>
+#include <sys/stat.h> // For mkdir() and stat() on the cache directory
+#include <dirent.h>   // For scanning the worker spool directory
+#include <poll.h>
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <pthread.h>  // Source loader and function body translation threads
+#include <sys/socket.h>  // Coordinator and remote worker connections
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#ifdef __linux__
+#include <sys/inotify.h>  // Spool directory notifications
+#endif
+#include <dlfcn.h>    // For dlopen() in zygote mode
+#include <sys/types.h>
+#include <sys/wait.h> // For waitpid()
+#include <sys/resource.h>  // For the peak memory of runs measured by --compare
+#include <sys/utsname.h>  // For the machine architecture in binary cache keys
 
+// Table sizes can be raised at build time (e.g. -DMAX_FUNCTIONS=20000) for large generated sources
 #define MAX_LINE_LENGTH 256
 #define MAX_IDENTIFIER_LENGTH 12
 #define MAX_IDENTIFIERS 50
+#ifndef MAX_FUNCTIONS
 #define MAX_FUNCTIONS 50
+#endif
+#ifndef MAX_GLOBAL_VARS
 #define MAX_GLOBAL_VARS 50
+#endif
+#define PARALLEL_PARSE_THRESHOLD 16  // Translate function bodies on several threads from this many functions
+#define PARALLEL_COMPILE_THRESHOLD 16  // Split the generated C into several translation units from this many functions
+#define MAX_COMPILE_UNITS 64
+#define BENCH_MAX_SAMPLES 1000  // A bench statement times at most this many batches of calls
+#define BENCH_MIN_BATCH_SECONDS 1e-5  // Batches are grown until one takes this long, so clock overhead stays small
+#define PARALLEL_CHUNKS 64  // Parallel repeat ranges are cut into at most this many chunks, whatever the thread count
+#define SPECIALIZE_ARGS_THRESHOLD 3  // --specialize-args: runs with the same argument values before they are compiled in
+#define MAX_FUNCTION_CLONES 64  // Constant argument tuples a function is specialized for; further ones keep the generic call
+#define MULTIVERSION_TARGETS "\"avx512f\", \"avx2\", \"default\""  // --multiversion: target_clones of the loop functions
+#define MAX_HOSTS 64
+#define SOURCE_LOADER_THREADS 8
+#define RESULT_CACHE_TTL 3600             // Seconds a cached program result stays valid
+#define RESULT_CACHE_MAX_OUTPUT (64 * 1024)  // Larger outputs are never cached
+#define RESULT_CACHE_MAX_BYTES (16 * 1024 * 1024)  // Oldest results are evicted beyond this total
 
 // Global verbose flag
 int verbose = 0;
 
+// Wall-clock seconds spent in each phase of one run
+typedef struct {
+    double transpile;
+    double compile;
+    double execute;
+} PhaseTimings;
+
+// Zygote mode: the program is built as a shared object, loaded once and forked per run
+int zygote_mode = 0;
+void *program_handle = NULL;
+int (*program_entry)(int, char **) = NULL;
+
+// Result cache: stdout and exit status of deterministic programs, keyed by program hash and arguments
+int cache_results = 0;
+uint64_t program_hash = 0;
+
+// Binary cache: compiled programs stored under the hash of their generated C and compile flags
+int cache_binaries = 0;
+char program_path[600] = "";  // The executable or shared object that runs the program
+
+// Optimization flag for the next compile; NULL uses -O2 for matrix programs and argument variants,
+// and the compiler default otherwise
+const char *optimization_flags = NULL;
+
+// --specialize-args: runs are counted per program and argument values in the cache, and values seen
+// SPECIALIZE_ARGS_THRESHOLD times get a cached variant in which arg0, arg1, ... are constants
+int specialize_arguments = 0;
+double *constant_arguments = NULL;  // Values of arg0..max_arg_index compiled into the program being generated, or NULL
+
+// Split compilation: requested number of translation units (0 picks one per core for large programs),
+// the number used for the current program, and its generated main() kept for the first unit
+int requested_units = 0;
+int compile_units = 1;
+char *generated_main = NULL;
+FILE *open_c_file = NULL;  // The C file being written, left open if a syntax error abandons the translation
+
+// Worker mode: number of processes claiming jobs from the spool directory
+int worker_count = 1;
+
+// An ml source read into memory by the loader threads
+typedef struct {
+    const char *filename;
+    char *source;
+    size_t length;
+    int loaded;  // 1 when loaded, -1 if the file could not be read
+} SourceBuffer;
+
+// Shared state of the loader threads: the next file to claim and the order files completed in
+typedef struct {
+    SourceBuffer *buffers;
+    int count;
+    int next;
+    int *completed;
+    int completed_count;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+} SourceLoader;
+
+// A stored result found while trimming the result cache
+typedef struct {
+    char filename[64];
+    time_t modified;
+    off_t size;
+} CachedResult;
+
+// A --check diagnostic, kept until the whole file is checked
+typedef struct {
+    int line;   // 0 for diagnostics about the file as a whole
+    int order;  // Position in the order reported, so a line's diagnostics stay in that order
+    int pass;
+    int is_error;
+    char *text;
+} CheckDiagnostic;
+
+// One argument set dispatched by the coordinator, with the result streamed back from a worker host
+typedef struct {
+    char args[MAX_LINE_LENGTH];
+    char *output;
+    size_t output_length;
+    int status;
+    int done;
+} RemoteJob;
+
+// Highest argN referenced by the program (-1 if none), a bit per referenced argN,
+// and whether its output depends only on its inputs
+int max_arg_index = -1;
+uint64_t referenced_args = 0;
+int program_is_deterministic = 1;
+
+// Row input mode: the program runs once per stdin row, with the row's columns as arg0, arg1, ...
+int row_input = 0;
+
+// Whether the program has parallel repeat blocks, which need the parallel runtime and thread flags
+int program_uses_parallel = 0;
+
+// Whether the program creates matrices, which need the matrix runtime
+int program_uses_matrices = 0;
+
+// Whether the program draws random numbers, which need the random runtime
+int program_uses_random = 0;
+
+// Whether the program reads the clock or has bench statements, which need the timing runtime
+int program_uses_timing = 0;
+
+// --line-counts: count how often each ml line runs; the program writes an annotated copy of the
+// source to line_counts_path when it finishes. Lines are numbered from 1 as the first pass reads them
+int line_counts = 0;
+char line_counts_path[1024] = "";
+int source_line_count = 0;
+unsigned char *counted_lines = NULL;  // Which lines carry a counter, indexed by line number
+
+// --opt-report: the generated C ties every line of a statement to its ml line with #line, so the
+// compiler's optimization remarks can be attributed to ml lines and written to opt_report_path.
+// Code that no ml line produced is placed in "<generated>"
+int opt_report = 0;
+char opt_report_path[1024] = "";
+char mapped_source_name[1024] = "";  // The ml file name, escaped for a C string literal
+_Thread_local int mapped_ml_line = 0;  // The ml line whose C is being captured, 0 if none
+
+// --multiversion: the functions with the program's loops (parallel repeat bodies and matrix kernels)
+// are compiled for each of MULTIVERSION_TARGETS, and the best one for the CPU is picked at load time
+int multiversion = 0;
+
+// --compile-report: compile every function as a translation unit of its own and report the
+// compile time and code size of each
+int compile_report = 0;
+
+// C generated for one ml line, captured so each of its lines can be given a #line directive
+typedef struct {
+    char *code;
+    size_t size;
+    FILE *file;
+    int line;
+    int saved_line;
+} MappedCode;
+
+// --trials: run the program body this many times over all cores and aggregate what it prints (0 runs it once)
+uint64_t trial_count = 0;
+
+// Constant-argument specialization: a call whose arguments are all numeric literals goes to a clone of
+// the callee with those parameters fixed, or folds to a constant expression (off with --no-specialize)
+int specialize_calls = 1;
+_Thread_local int emitting_bench_call = 0;  // A benchmarked call must stay a real call
+pthread_mutex_t specialization_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// --precision: the C type of real values ("double", or "float" for f32). The translator's own tables
+// keep calling the type "double"; c_type() maps it when a declaration is written
+const char *real_type = "double";
+// --verify-precision: print writes every real with %.17g, so no error is hidden by rounding to six decimals
+int print_all_digits = 0;
+
+// Builtins callable from expressions, emitted as ml_<name>; a user function of the same name takes precedence
+const char *builtin_functions[] = { "matrix", "matmul", "transpose", "madd", "msub", "mmul", "mscale", "rows", "cols", "rand", "normal", "clock", NULL };
+
 // Struct to hold function information
 typedef struct {
     char name[MAX_IDENTIFIER_LENGTH + 1];
@@ -28,6 +226,21 @@ typedef struct {
     char return_type[10];
     char body[MAX_LINE_LENGTH * MAX_IDENTIFIERS];
     int has_return_statement;
+    char *source;          // Raw body lines, translated into body once every function is known
+    int visible_globals;   // Number of globals defined before the function, the ones its body can see
+    char *deferred_calls;  // Call statements in the body, applied to parameter types in source order
+    char *generated_code;  // Emitted prototype line and definition, kept when compiling in several units
+    char *parallel_code;   // Outlined parallel repeat blocks of the body, emitted before its definition
+    int returns_matrix;    // Whether a return expression is a matrix
+    int *line_numbers;     // Source line of each body line, for --line-counts
+    char *fold_expression; // Return expression when the body is only "return <expression of the parameters>"
+    int specializable;     // Whether constant call sites may use a clone (no matrices, no parallel repeat)
+    int folded;            // 1 once a call site was folded, 2 once its ml_fold_ macro is written
+    char **clones;         // Constant argument tuples the function is cloned for, comma-separated
+    int clone_count;
+    int emitted_clone_count;
+    size_t declaration_size;  // Length of the declarations at the start of generated_code
+    int compile_unit;         // Translation unit that defines the function when compiling in several units
 } Function;
 
 // Struct to hold variable information
@@ -41,8 +254,49 @@ Function functions[MAX_FUNCTIONS];
 int function_count = 0;
 Variable global_variables[MAX_GLOBAL_VARS];
 int global_var_count = 0;
-Variable local_variables[MAX_IDENTIFIERS];
-int local_var_count = 0;
+
+// Per-thread translation context: the current scope's locals, how many globals it can see (-1 for all)
+// and the function whose body is being translated (NULL for the main program)
+_Thread_local Variable local_variables[MAX_IDENTIFIERS];
+_Thread_local int local_var_count = 0;
+_Thread_local int visible_global_count = -1;
+_Thread_local Function *translating_function = NULL;
+
+// Where the current scope's outlined parallel repeat blocks are written, and how many it has so far
+_Thread_local FILE *parallel_code_file = NULL;
+_Thread_local int parallel_block_count = 0;
+
+// Source line of the statement being translated (0 when unknown), for --line-counts and error locations,
+// and whether it is inside a parallel repeat block, whose lines are counted at the call site
+_Thread_local int current_ml_line = 0;
+_Thread_local int translating_parallel_body = 0;
+
+// --check: validate programs without generating or compiling C. Errors are reported as file:line
+// and, instead of exiting, jump back to check_recovery so checking resumes at the next statement.
+// A file's diagnostics are collected in check_diagnostics and printed in line order once it is checked
+int check_mode = 0;
+const char *check_filename = "";
+int check_error_count = 0;
+int check_pass = 1;  // The pass being checked; the second skips errors on lines the first reported
+CheckDiagnostic *check_diagnostics = NULL;
+int check_diagnostic_count = 0;
+int check_diagnostic_capacity = 0;
+_Thread_local jmp_buf *check_recovery = NULL;
+
+// Runs one translation step; in --check mode an error inside it abandons only that step
+#define CHECKED_STEP(step) do { \
+        jmp_buf *previous_recovery = check_recovery; \
+        jmp_buf recovery; \
+        if (!check_mode) { \
+            step; \
+        } else { \
+            check_recovery = &recovery; \
+            if (setjmp(recovery) == 0) { \
+                step; \
+            } \
+        } \
+        check_recovery = previous_recovery; \
+    } while (0)
 
 // Function declarations (forward declarations)
 void usage(const char *program_name);
@@ -51,22 +305,118 @@ void error_log(const char *error_type, const char *format, ...);
 FILE *open_ml_file(const char *ml_filename);
 FILE *create_c_file();
 void first_pass(FILE *ml_file);
+void first_pass_line(const char *line, FILE *ml_file);
 void second_pass(FILE *ml_file, FILE *c_file);
+void write_c_includes(FILE *c_file);
+int write_translation_units(pid_t pid);
+int compile_translation_units(pid_t pid, const char *compile_flags, const char *link_flags, const char *output_filename);
 int compile_c_program(pid_t pid);
-int execute_c_program(pid_t pid, int argc, char *argv[]);
+int load_c_program(void);
+int execute_c_program(pid_t pid, int argc, char *argv[], const char *output_filename);
+int run_zygote(pid_t pid);
+int run_ml_file(const char *ml_filename, int argc, char *argv[], PhaseTimings *timings);
+int emit_c_program(const char *ml_filename, const char *c_filename);
+int measure_program_run(pid_t pid, int argc, char *argv[], const char *output_filename, double *seconds, long *peak_kilobytes);
+int files_identical(const char *first_filename, const char *second_filename);
+int run_comparison(const char *ml_filename, int argc, char *argv[]);
+int compare_doubles(const void *first, const void *second);
+int compare_strings(const void *first, const void *second);
+double percentile(const double *sorted_values, int count, double fraction);
+int run_benchmark(const char *ml_filename, int argc, char *argv[], int runs);
+int run_worker(const char *spool_directory);
+void worker_loop(const char *spool_directory);
+int claim_spool_job(const char *spool_directory, char *job_name, size_t job_name_size);
+void process_spool_job(const char *spool_directory, const char *job_name);
+double now_seconds(void);
+int transpile_ml_file(const char *ml_filename);
+int transpile_ml_stream(FILE *ml_file);
+void reset_transpiler_state(void);
+int read_source_file(SourceBuffer *buffer);
+void *source_loader_thread(void *argument);
+int run_precompile(int file_count, char *filenames[]);
+int run_check(int file_count, char *filenames[]);
+void record_check_diagnostic(int line, int is_error, const char *message);
+void print_check_diagnostics(void);
+int compare_check_diagnostics(const void *first, const void *second);
+int write_all(int fd, const void *data, size_t length);
+int read_exact(int fd, void *data, size_t length);
+int read_line(int fd, char *line, size_t size);
+int open_listener(const char *address, int *port);
+int connect_to_host(const char *host_spec);
+void serve_connections(int listen_fd);
+void serve_coordinator(int connection_fd);
+int run_coordinator(const char *ml_filename, const char *host_list, int local_workers);
 void clean_up(pid_t pid);
+void scan_program_references(const char *line);
+uint64_t hash_bytes(uint64_t hash, const void *data, size_t length);
+uint64_t hash_c_program(pid_t pid);
+int tokens_would_merge(char previous, char next);
+const char *cache_directory(void);
+uint64_t result_cache_key(int argc, char *argv[]);
+int record_argument_values(int argc, char *argv[]);
+int replay_cached_result(uint64_t key, int *status);
+void store_cached_result(uint64_t key, int status, const char *output_filename);
+void trim_result_cache(const char *directory);
+int compare_cached_results(const void *first, const void *second);
+int execute_and_cache(pid_t pid, int argc, char *argv[]);
+int copy_file_to_stream(const char *filename, FILE *stream);
 void store_function_definition_and_body(const char *line, FILE *file);
 void store_variable(const char *line, int is_global);
+void translate_function_body(int index);
+void *function_translation_thread(void *argument);
+void translate_function_bodies(void);
 void generate_global_variables(FILE *output_file);
-void generate_function_prototypes_and_code(FILE *output_file);
+void generate_function_prototypes_and_code(FILE *c_file);
 void generate_main_code(FILE *ml_file, FILE *output_file);
 void generate_c_code(const char *ml_code, FILE *output_file);
+void generate_parallel_repeat(const char *header, char *body, FILE *output_file);
+void translate_parallel_body_line(const char *line, char names[][MAX_IDENTIFIER_LENGTH + 1], char types[][MAX_IDENTIFIER_LENGTH + 32], char operations[][4], int accumulator_count, FILE *loop_file);
+void write_parallel_runtime(FILE *c_file);
+void write_row_input_runtime(FILE *c_file);
+void write_matrix_runtime(FILE *c_file);
+void write_random_runtime(FILE *c_file);
+void write_timing_runtime(FILE *c_file);
+void generate_bench_statement(FILE *output_file, const char *statement);
+void record_function_call(const char *ml_code);
+void generate_line_counter(FILE *output_file, int line_number, const char *amount);
+FILE *begin_mapped_code(MappedCode *mapped);
+void end_mapped_code(MappedCode *mapped, FILE *output_file);
+const char *optimization_remark_flags(void);
+int write_opt_report(pid_t pid, const char *ml_filename);
+void print_compile_report(pid_t pid, const double *unit_seconds, double link_seconds);
+const char *target_isa(void);
+void check_expression(const char *expr);
+void check_expression_grammar(const char *expr);
+int builtin_arity(const char *name);
+const char *c_type(const char *type);
+int needs_float_suffix(const char *literal, size_t length);
+void check_cancellation(const char *expr);
+int run_precision_check(const char *ml_filename, int argc, char *argv[], double tolerance);
+void write_line_counts_runtime(FILE *c_file, FILE *ml_file);
+int line_calls(const char *line, const char *name);
+int run_trials(pid_t pid, int argc, char *argv[]);
+void format_number(char *buffer, size_t size, double value);
+double square_root(double value);
+const char *builtin_return_type(const char *name);
+void rewrite_builtin_calls(const char *expr, char *output, size_t size);
+const char *parallel_thread_flags(void);
+const char *program_libraries(void);
 void parse_expression(const char *expr, FILE *output_file);
 void parse_term_or_factor(const char *expr, FILE *output_file);
 char *determine_variable_type(const char *value);
+char *lookup_variable_type(const char *name);
 void generate_print_statement(FILE *output_file, const char *expression);
-void determine_parameter_types(const char *function_call);
+void determine_parameter_types(const char *function_call, int visible_functions);
 void update_function_prototype(const char *function_name);
+void infer_matrix_signature(Function *func);
+void settle_matrix_return_type(Function *func);
+void find_specialization_forms(Function *func);
+int specialize_constant_calls(const char *expr, char *output, size_t size, int allow_fold);
+int is_numeric_literal(const char *literal, size_t length);
+double evaluate_fold(const char **expr, const Function *func, const double *values, int integer, int level, int *valid);
+int register_clone(Function *func, const char *arguments);
+void write_specialization_declarations(FILE *output_file, Function *func);
+void write_specialization_definitions(FILE *output_file, Function *func);
 int check_parentheses_balance(const char *line);
 int is_valid_identifier(const char *name);
 int check_type_consistency(const char *var_type, const char *value);
@@ -77,7 +427,36 @@ int check_function_variable_conflict(const char *var_name);
  * @param program_name - Name of the program, typically argv[0].
  */
 void usage(const char *program_name) {
-    fprintf(stderr, "Usage: %s <ml-file> [-v]\n", program_name);
+    fprintf(stderr, "Usage: %s [options] <ml-file> [args...] [-v]\n", program_name);
+    fprintf(stderr, "       %s --precompile <ml-file>...\n", program_name);
+    fprintf(stderr, "       %s --check <ml-file>...\n", program_name);
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  -v                   Enable verbose debug output\n");
+    fprintf(stderr, "  -z, --zygote         Load the program once and fork per run; reads one argument set per line from stdin\n");
+    fprintf(stderr, "  -r, --cache-results  Reuse the stored output of earlier runs with the same program and arguments\n");
+    fprintf(stderr, "  -c, --cache-binaries Reuse compiled programs from the cache instead of recompiling\n");
+    fprintf(stderr, "  --rows               Run the program once per stdin row, with the row's columns as arg0, arg1, ...\n");
+    fprintf(stderr, "  --trials <n>         Run the program n times over all cores and print statistics of each printed value\n");
+    fprintf(stderr, "  --seed <s>           Seed for rand() and normal() (default $RUNML_SEED, else 0)\n");
+    fprintf(stderr, "  --units <n>          Compile the program as n translation units in parallel\n");
+    fprintf(stderr, "  --emit-c <file>      Write the generated C to file instead of compiling and running it\n");
+    fprintf(stderr, "  --line-counts        Count how often each line runs and write the annotated source to <ml-file>.lines\n");
+    fprintf(stderr, "  --multiversion       Compile loops for AVX-512, AVX2 and baseline x86-64, choosing at run time, so one binary suits every host\n");
+    fprintf(stderr, "  --compile-report     Compile each function separately and print its compile time and code size\n");
+    fprintf(stderr, "  --opt-report         Write the compiler's vectorization and inlining remarks per line to <ml-file>.opt\n");
+    fprintf(stderr, "  --precision=f32      Compute real values in float instead of double, warning about subtractions at risk of cancellation\n");
+    fprintf(stderr, "  --verify-precision <tol>  Run the program in f64 and f32 and check every printed number agrees within tol\n");
+    fprintf(stderr, "  --no-specialize      Keep generic calls for calls whose arguments are all constants\n");
+    fprintf(stderr, "  --specialize-args    Compile argument values used %d times into a cached variant of the program (implies -c)\n", SPECIALIZE_ARGS_THRESHOLD);
+    fprintf(stderr, "  --compare            Run the program through every engine, check the outputs match and compare their costs\n");
+    fprintf(stderr, "  --bench <n>          Run the whole pipeline n times and print latency percentiles per phase (add -c for a warm cache)\n");
+    fprintf(stderr, "  --worker <dir>       Process .ml jobs dropped into a spool directory (see -j)\n");
+    fprintf(stderr, "  -j <n>               Number of worker processes\n");
+    fprintf(stderr, "  --precompile         Compile every following ml file into the binary cache\n");
+    fprintf(stderr, "  --check              Parse and type-check every following ml file without compiling, reporting all errors\n");
+    fprintf(stderr, "  --serve [addr:]port  Run jobs sent by a coordinator (binds 127.0.0.1 unless addr is given)\n");
+    fprintf(stderr, "  --hosts <h:p,...>    Coordinate: run one job per stdin line on the listed worker hosts\n");
+    fprintf(stderr, "  --local-workers <n>  Coordinate using n workers started on loopback ports\n");
 }
 
 /**
@@ -106,29 +485,113 @@ void debug_log(const char *log_type, const char *format, ...) {
 
 /**
  * Error log function for displaying error messages.
- * Automatically prepends either '! Error [SYNTAX] : ' or '! Error [FILE] : ' based on the error_type.
+ * Automatically prepends '! Error [SYNTAX] : ', '! Error [FILE] : ' or '! Warning [PRECISION] : ' based on the error_type.
  * 
- * @param error_type - Specifies the type of error, either "SYNTAX" or "FILE".
+ * @param error_type - Specifies the type of error, "SYNTAX", "FILE", or "PRECISION" for a warning about the current line.
  * @param format - The format string (similar to printf).
  * @param ... - The variable arguments to format and print.
- * Exits the program immediately upon encountering a syntax error.
+ * Exits the program immediately upon encountering a syntax error, unless --precompile set a check_recovery point.
  */
 void error_log(const char *error_type, const char *format, ...) {
     va_list args;
     va_start(args, format);
+
+    if (check_mode) {
+        // Collected rather than fatal: recorded with the location, and checking resumes at the next statement
+        char message[MAX_LINE_LENGTH * 2];
+        vsnprintf(message, sizeof(message), format, args);
+        va_end(args);
+        record_check_diagnostic(current_ml_line, strcmp(error_type, "PRECISION") != 0, message);
+        if (strcmp(error_type, "SYNTAX") == 0 && check_recovery) {
+            longjmp(*check_recovery, 1);
+        }
+        return;
+    }
     
     if (strcmp(error_type, "SYNTAX") == 0) {
         fprintf(stderr, "! Error [SYNTAX] : ");
         vfprintf(stderr, format, args);  // Print the formatted error message to stderr
+        va_end(args);
+        if (check_recovery) {
+            longjmp(*check_recovery, 1);  // --precompile: abandon this file and go on with the next
+        }
         exit(EXIT_FAILURE);
     } else if (strcmp(error_type, "FILE") == 0) {
         fprintf(stderr, "! Error [FILE] : ");
         vfprintf(stderr, format, args);  // Print the formatted error message to stderr
+    } else if (strcmp(error_type, "PRECISION") == 0) {
+        fprintf(stderr, "! Warning [PRECISION] : line %d: ", current_ml_line);  // Reported, not fatal
+        vfprintf(stderr, format, args);
     }
     
     va_end(args);
 }
 
+/**
+ * Records a --check diagnostic for the current file. An error on a line the first pass already
+ * reported an error for is the same fault seen again by the second pass, and is dropped.
+ * @param line - The source line, or 0 for the file as a whole.
+ * @param is_error - 1 for an error, 0 for a warning.
+ * @param message - The message, ending in a newline.
+ */
+void record_check_diagnostic(int line, int is_error, const char *message) {
+    for (int i = 0; is_error && line > 0 && check_pass > 1 && i < check_diagnostic_count; i++) {
+        if (check_diagnostics[i].line == line && check_diagnostics[i].is_error && check_diagnostics[i].pass == 1) {
+            return;
+        }
+    }
+
+    if (check_diagnostic_count == check_diagnostic_capacity) {
+        int capacity = check_diagnostic_capacity ? check_diagnostic_capacity * 2 : 16;
+        CheckDiagnostic *grown = realloc(check_diagnostics, capacity * sizeof(CheckDiagnostic));
+        if (!grown) {
+            fprintf(stderr, "%s: error: %s", check_filename, message);  // Out of memory: report it unsorted
+            check_error_count += is_error;
+            return;
+        }
+        check_diagnostics = grown;
+        check_diagnostic_capacity = capacity;
+    }
+    CheckDiagnostic *diagnostic = &check_diagnostics[check_diagnostic_count];
+    diagnostic->line = line;
+    diagnostic->order = check_diagnostic_count;
+    diagnostic->pass = check_pass;
+    diagnostic->is_error = is_error;
+    diagnostic->text = strdup(message);
+    check_diagnostic_count++;
+    check_error_count += is_error;
+}
+
+/**
+ * Prints the current file's --check diagnostics sorted by line, then forgets them.
+ */
+void print_check_diagnostics(void) {
+    qsort(check_diagnostics, check_diagnostic_count, sizeof(CheckDiagnostic), compare_check_diagnostics);
+    for (int i = 0; i < check_diagnostic_count; i++) {
+        CheckDiagnostic *diagnostic = &check_diagnostics[i];
+        const char *kind = diagnostic->is_error ? "error" : "warning";
+        if (diagnostic->line > 0) {
+            fprintf(stderr, "%s:%d: %s: %s", check_filename, diagnostic->line, kind, diagnostic->text ? diagnostic->text : "\n");
+        } else {
+            fprintf(stderr, "%s: %s: %s", check_filename, kind, diagnostic->text ? diagnostic->text : "\n");
+        }
+        free(diagnostic->text);
+    }
+    check_diagnostic_count = 0;
+}
+
+/**
+ * Orders --check diagnostics by line, keeping the reported order within a line.
+ * @param first - Pointer to the first CheckDiagnostic.
+ * @param second - Pointer to the second CheckDiagnostic.
+ * @return - Negative, zero or positive like strcmp.
+ */
+int compare_check_diagnostics(const void *first, const void *second) {
+    const CheckDiagnostic *a = first, *b = second;
+    if (a->line != b->line) return a->line < b->line ? -1 : 1;
+    return (a->order > b->order) - (a->order < b->order);
+}
+
 /**
  * Opens the ml file for reading.
  * @param ml_filename - Path to the ml file.
@@ -162,13 +625,545 @@ FILE *create_c_file() {
 
     // Write necessary includes
     if (c_file) {
-        fprintf(c_file, "#include <stdio.h>\n");
-        fprintf(c_file, "#include <math.h>\n");  // Include math for fmod
+        write_c_includes(c_file);
     }
 
     return c_file;
 }
 
+/**
+ * Writes the includes every generated C file needs.
+ * @param c_file - The generated C file or header.
+ */
+void write_c_includes(FILE *c_file) {
+    if (program_uses_parallel || program_uses_timing) {
+        fprintf(c_file, "#define _POSIX_C_SOURCE 200809L\n");  // For sysconf and clock_gettime in the runtimes
+    }
+    fprintf(c_file, "#include <stdio.h>\n");
+    fprintf(c_file, "#include <math.h>\n");  // Include math for fmod
+    fprintf(c_file, "#include <stdlib.h>\n");  // Include stdlib for atof on arguments
+    fprintf(c_file, "#include <stdint.h>\n");  // Include stdint and inttypes for exact 64-bit integers
+    fprintf(c_file, "#include <inttypes.h>\n");
+
+    if (multiversion) {
+        // Function multi-versioning needs GCC or clang on x86-64 and the loader's ifunc support, which
+        // glibc has and macOS lacks; elsewhere the loop functions are compiled once, for the baseline
+        fprintf(c_file, "#if defined(__x86_64__) && defined(__GLIBC__) && !defined(__APPLE__) && defined(__has_attribute)\n");
+        fprintf(c_file, "#if __has_attribute(target_clones)\n");
+        fprintf(c_file, "#define ML_MULTIVERSION __attribute__((target_clones(%s)))\n", MULTIVERSION_TARGETS);
+        fprintf(c_file, "#endif\n#endif\n");
+        fprintf(c_file, "#ifndef ML_MULTIVERSION\n#define ML_MULTIVERSION\n#endif\n");
+    }
+
+    if (program_uses_matrices) {
+        // Matrices are references to row-major storage whose rows start on 64-byte boundaries
+        fprintf(c_file, "#include <string.h>\n");
+        fprintf(c_file, "typedef struct ml_matrix { int64_t rows, cols, stride; double *data; } *ml_mat;\n");
+        fprintf(c_file, "ml_mat ml_matrix(int64_t rows, int64_t cols);\n");
+        fprintf(c_file, "double *ml_at(ml_mat m, int64_t i, int64_t j);\n");
+        fprintf(c_file, "double ml_get(ml_mat m, int64_t i, int64_t j);\n");
+        fprintf(c_file, "int64_t ml_rows(ml_mat m);\n");
+        fprintf(c_file, "int64_t ml_cols(ml_mat m);\n");
+        fprintf(c_file, "ml_mat ml_matmul(ml_mat a, ml_mat b);\n");
+        fprintf(c_file, "ml_mat ml_transpose(ml_mat a);\n");
+        fprintf(c_file, "ml_mat ml_madd(ml_mat a, ml_mat b);\n");
+        fprintf(c_file, "ml_mat ml_msub(ml_mat a, ml_mat b);\n");
+        fprintf(c_file, "ml_mat ml_mmul(ml_mat a, ml_mat b);\n");
+        fprintf(c_file, "ml_mat ml_mscale(ml_mat a, double s);\n");
+        fprintf(c_file, "void ml_print_matrix(ml_mat m);\n");
+    }
+
+    if (program_uses_random) {
+        // Random numbers come from a per-thread counter-based stream
+        fprintf(c_file, "typedef struct { uint64_t key, counter; } ml_random_state;\n");
+        fprintf(c_file, "void ml_random_start(uint64_t seed, uint64_t stream);\n");
+        fprintf(c_file, "uint64_t ml_random_fork(void);\n");
+        fprintf(c_file, "ml_random_state ml_random_substream(uint64_t key, int64_t index);\n");
+        fprintf(c_file, "ml_random_state ml_random_swap(ml_random_state next);\n");
+        fprintf(c_file, "double ml_rand(void);\n");
+        fprintf(c_file, "double ml_normal(void);\n");
+    }
+    if (program_uses_timing) {
+        // clock() and bench statements; results of benchmarked calls are stored to volatile sinks
+        fprintf(c_file, "#include <time.h>\n");
+        fprintf(c_file, "double ml_clock(void);\n");
+        fprintf(c_file, "extern volatile double ml_bench_sink;\n");
+        fprintf(c_file, "extern void *volatile ml_bench_pointer_sink;\n");
+        fprintf(c_file, "int64_t ml_bench_sample_count(int64_t calls, int64_t batch);\n");
+        fprintf(c_file, "void ml_bench_report(const char *label, double *samples, int64_t count, int64_t batch);\n");
+    }
+    if (line_counts) {
+        // Hit counts per ml line, written next to the source when main() returns
+        if (program_uses_parallel) {
+            fprintf(c_file, "#include <stdatomic.h>\n");
+            fprintf(c_file, "extern _Atomic uint64_t ml_line_hits[%d];\n", source_line_count + 1);
+        } else {
+            fprintf(c_file, "extern uint64_t ml_line_hits[%d];\n", source_line_count + 1);
+        }
+        fprintf(c_file, "void ml_write_line_counts(void);\n");
+    }
+    if (trial_count > 0) {
+        fprintf(c_file, "void ml_trial_start(void);\n");
+        fprintf(c_file, "void ml_trial_print(double value);\n");
+    }
+
+    if (program_uses_parallel) {
+        // Parallel repeat blocks are outlined into functions over chunk `chunk` of the index range, [begin, end)
+        fprintf(c_file, "#include <pthread.h>\n");
+        fprintf(c_file, "#include <unistd.h>\n");
+        fprintf(c_file, "#define ML_PARALLEL_CHUNKS %d\n", PARALLEL_CHUNKS);
+        fprintf(c_file, "typedef void (*ml_range_function)(void *context, int64_t chunk, int64_t begin, int64_t end);\n");
+        fprintf(c_file, "int64_t ml_parallel_chunks(int64_t count);\n");
+        fprintf(c_file, "void ml_parallel_for(int64_t count, ml_range_function body, void *context);\n");
+    }
+}
+
+/**
+ * Writes the runtime behind parallel repeat blocks. The index range is cut into a fixed number
+ * of chunks that depends only on the count, never on the thread count, and each chunk leaves its
+ * partial results in its own slot. Merging the slots in chunk order keeps floating-point sums
+ * bit-identical however many threads ran them. With OpenMP the chunks are shared out by a
+ * static parallel for; otherwise by one pthread per online core, or OMP_NUM_THREADS pthreads
+ * when it is set, each taking every n-th chunk.
+ * @param c_file - The generated C file, or the unit that defines main().
+ */
+void write_parallel_runtime(FILE *c_file) {
+    fprintf(c_file, "#ifdef _OPENMP\n#include <omp.h>\n#endif\n");
+    fprintf(c_file, "int64_t ml_parallel_chunks(int64_t count) {\n");
+    fprintf(c_file, "return count <= 0 ? 0 : count < ML_PARALLEL_CHUNKS ? count : ML_PARALLEL_CHUNKS;\n}\n");
+    fprintf(c_file, "static int64_t ml_parallel_split(int64_t count, int64_t chunks, int64_t c) {\n");
+    fprintf(c_file, "return count / chunks * c + (c < count %% chunks ? c : count %% chunks);\n}\n");
+    fprintf(c_file, "#ifndef _OPENMP\n");
+    fprintf(c_file, "typedef struct { ml_range_function body; void *context; int64_t count, chunks, first, stride; } ml_parallel_worker_range;\n");
+    fprintf(c_file, "static void *ml_parallel_worker(void *argument) {\n");
+    fprintf(c_file, "ml_parallel_worker_range *range = argument;\n");
+    fprintf(c_file, "for (int64_t c = range->first; c < range->chunks; c += range->stride) {\n");
+    fprintf(c_file, "range->body(range->context, c, ml_parallel_split(range->count, range->chunks, c), ml_parallel_split(range->count, range->chunks, c + 1));\n");
+    fprintf(c_file, "}\n");
+    fprintf(c_file, "return NULL;\n}\n");
+    fprintf(c_file, "#endif\n");
+    fprintf(c_file, "void ml_parallel_for(int64_t count, ml_range_function body, void *context) {\n");
+    fprintf(c_file, "int64_t chunks = ml_parallel_chunks(count);\n");
+    fprintf(c_file, "if (chunks == 0) return;\n");
+    fprintf(c_file, "#ifdef _OPENMP\n");
+    fprintf(c_file, "#pragma omp parallel for schedule(static)\n");
+    fprintf(c_file, "for (int64_t c = 0; c < chunks; c++) {\n");
+    fprintf(c_file, "body(context, c, ml_parallel_split(count, chunks, c), ml_parallel_split(count, chunks, c + 1));\n");
+    fprintf(c_file, "}\n");
+    fprintf(c_file, "#else\n");
+    fprintf(c_file, "const char *ml_threads = getenv(\"OMP_NUM_THREADS\");  // Honored as OpenMP builds do\n");
+    fprintf(c_file, "int64_t threads = ml_threads && atoll(ml_threads) > 0 ? atoll(ml_threads) : sysconf(_SC_NPROCESSORS_ONLN);\n");
+    fprintf(c_file, "if (threads < 1) threads = 1;\n");
+    fprintf(c_file, "if (threads > chunks) threads = chunks;\n");
+    fprintf(c_file, "pthread_t workers[ML_PARALLEL_CHUNKS];\n");
+    fprintf(c_file, "ml_parallel_worker_range ranges[ML_PARALLEL_CHUNKS];\n");
+    fprintf(c_file, "for (int64_t t = 0; t < threads; t++) {\n");
+    fprintf(c_file, "ranges[t] = (ml_parallel_worker_range){ body, context, count, chunks, t, threads };\n");
+    fprintf(c_file, "if (t > 0 && pthread_create(&workers[t], NULL, ml_parallel_worker, &ranges[t]) != 0) { ml_parallel_worker(&ranges[t]); ranges[t].body = NULL; }\n");
+    fprintf(c_file, "}\n");
+    fprintf(c_file, "ml_parallel_worker(&ranges[0]);\n");
+    fprintf(c_file, "for (int64_t t = 1; t < threads; t++) {\n");
+    fprintf(c_file, "if (ranges[t].body) pthread_join(workers[t], NULL);\n");
+    fprintf(c_file, "}\n");
+    fprintf(c_file, "#endif\n");
+    fprintf(c_file, "}\n\n");
+}
+
+/**
+ * Writes the matrix runtime. Storage comes from aligned_alloc with each row padded to a multiple
+ * of 8 doubles, so rows start on cache-line boundaries. matmul and transpose work on 64x64 and
+ * 32x32 tiles to stay in cache, and the inner loops run over contiguous restrict rows so the
+ * compiler can vectorize them. Every operation returns a new matrix; matrices live until exit.
+ * @param c_file - The generated C file, or the unit that defines main().
+ */
+void write_matrix_runtime(FILE *c_file) {
+    fprintf(c_file, "#define ML_MATMUL_BLOCK 64\n#define ML_TRANSPOSE_BLOCK 32\n");
+    fprintf(c_file, "static void ml_matrix_error(const char *message, ml_mat a, ml_mat b) {\n");
+    fprintf(c_file, "fprintf(stderr, \"Matrix error: %%s (%%\" PRId64 \"x%%\" PRId64, message, a->rows, a->cols);\n");
+    fprintf(c_file, "if (b) fprintf(stderr, \" and %%\" PRId64 \"x%%\" PRId64, b->rows, b->cols);\n");
+    fprintf(c_file, "fprintf(stderr, \")\\n\");\n");
+    fprintf(c_file, "exit(EXIT_FAILURE);\n}\n");
+    fprintf(c_file, "static ml_mat ml_checked(ml_mat m) {\n");
+    fprintf(c_file, "if (!m) { fprintf(stderr, \"Matrix error: matrix used before it was assigned\\n\"); exit(EXIT_FAILURE); }\n");
+    fprintf(c_file, "return m;\n}\n");
+
+    fprintf(c_file, "ml_mat ml_matrix(int64_t rows, int64_t cols) {\n");
+    fprintf(c_file, "if (rows < 1 || cols < 1) { fprintf(stderr, \"Matrix error: invalid size %%\" PRId64 \"x%%\" PRId64 \"\\n\", rows, cols); exit(EXIT_FAILURE); }\n");
+    fprintf(c_file, "int64_t stride = (cols + 7) & ~(int64_t)7;\n");
+    fprintf(c_file, "size_t size = (size_t)(rows * stride) * sizeof(double);\n");
+    fprintf(c_file, "ml_mat m = malloc(sizeof(*m));\n");
+    fprintf(c_file, "double *data = aligned_alloc(64, size);\n");
+    fprintf(c_file, "if (!m || !data) { fprintf(stderr, \"Out of memory allocating a matrix\\n\"); exit(EXIT_FAILURE); }\n");
+    fprintf(c_file, "memset(data, 0, size);\n");
+    fprintf(c_file, "m->rows = rows;\nm->cols = cols;\nm->stride = stride;\nm->data = data;\n");
+    fprintf(c_file, "return m;\n}\n");
+
+    fprintf(c_file, "double *ml_at(ml_mat m, int64_t i, int64_t j) {\n");
+    fprintf(c_file, "ml_checked(m);\n");
+    fprintf(c_file, "if (i < 0 || i >= m->rows || j < 0 || j >= m->cols) {\n");
+    fprintf(c_file, "fprintf(stderr, \"Matrix error: index [%%\" PRId64 \", %%\" PRId64 \"] out of range (%%\" PRId64 \"x%%\" PRId64 \")\\n\", i, j, m->rows, m->cols);\n");
+    fprintf(c_file, "exit(EXIT_FAILURE);\n}\n");
+    fprintf(c_file, "return &m->data[i * m->stride + j];\n}\n");
+    fprintf(c_file, "double ml_get(ml_mat m, int64_t i, int64_t j) { return *ml_at(m, i, j); }\n");
+    fprintf(c_file, "int64_t ml_rows(ml_mat m) { return ml_checked(m)->rows; }\n");
+    fprintf(c_file, "int64_t ml_cols(ml_mat m) { return ml_checked(m)->cols; }\n");
+
+    const char *loop_attribute = multiversion ? "ML_MULTIVERSION " : "";  // The kernels with loops over elements
+    fprintf(c_file, "%sml_mat ml_matmul(ml_mat a, ml_mat b) {\n", loop_attribute);
+    fprintf(c_file, "if (ml_checked(a)->cols != ml_checked(b)->rows) ml_matrix_error(\"matmul needs as many columns on the left as rows on the right\", a, b);\n");
+    fprintf(c_file, "ml_mat c = ml_matrix(a->rows, b->cols);\n");
+    fprintf(c_file, "for (int64_t ii = 0; ii < a->rows; ii += ML_MATMUL_BLOCK) {\n");
+    fprintf(c_file, "int64_t i_end = ii + ML_MATMUL_BLOCK < a->rows ? ii + ML_MATMUL_BLOCK : a->rows;\n");
+    fprintf(c_file, "for (int64_t kk = 0; kk < a->cols; kk += ML_MATMUL_BLOCK) {\n");
+    fprintf(c_file, "int64_t k_end = kk + ML_MATMUL_BLOCK < a->cols ? kk + ML_MATMUL_BLOCK : a->cols;\n");
+    fprintf(c_file, "for (int64_t jj = 0; jj < b->cols; jj += ML_MATMUL_BLOCK) {\n");
+    fprintf(c_file, "int64_t j_end = jj + ML_MATMUL_BLOCK < b->cols ? jj + ML_MATMUL_BLOCK : b->cols;\n");
+    fprintf(c_file, "for (int64_t i = ii; i < i_end; i++) {\n");
+    fprintf(c_file, "double *restrict out = c->data + i * c->stride;\n");
+    fprintf(c_file, "for (int64_t k = kk; k < k_end; k++) {\n");
+    fprintf(c_file, "const double scale = a->data[i * a->stride + k];\n");
+    fprintf(c_file, "const double *restrict row = b->data + k * b->stride;\n");
+    fprintf(c_file, "for (int64_t j = jj; j < j_end; j++) out[j] += scale * row[j];\n");
+    fprintf(c_file, "}\n}\n}\n}\n}\n");
+    fprintf(c_file, "return c;\n}\n");
+
+    fprintf(c_file, "%sml_mat ml_transpose(ml_mat a) {\n", loop_attribute);
+    fprintf(c_file, "ml_mat t = ml_matrix(ml_checked(a)->cols, a->rows);\n");
+    fprintf(c_file, "for (int64_t ii = 0; ii < a->rows; ii += ML_TRANSPOSE_BLOCK) {\n");
+    fprintf(c_file, "int64_t i_end = ii + ML_TRANSPOSE_BLOCK < a->rows ? ii + ML_TRANSPOSE_BLOCK : a->rows;\n");
+    fprintf(c_file, "for (int64_t jj = 0; jj < a->cols; jj += ML_TRANSPOSE_BLOCK) {\n");
+    fprintf(c_file, "int64_t j_end = jj + ML_TRANSPOSE_BLOCK < a->cols ? jj + ML_TRANSPOSE_BLOCK : a->cols;\n");
+    fprintf(c_file, "for (int64_t i = ii; i < i_end; i++) {\n");
+    fprintf(c_file, "for (int64_t j = jj; j < j_end; j++) t->data[j * t->stride + i] = a->data[i * a->stride + j];\n");
+    fprintf(c_file, "}\n}\n}\n");
+    fprintf(c_file, "return t;\n}\n");
+
+    // Element-wise operations: 0 adds, 1 subtracts, 2 multiplies
+    fprintf(c_file, "%sstatic ml_mat ml_elementwise(ml_mat a, ml_mat b, int operation) {\n", loop_attribute);
+    fprintf(c_file, "if (ml_checked(a)->rows != ml_checked(b)->rows || a->cols != b->cols) ml_matrix_error(\"element-wise operation on matrices of different sizes\", a, b);\n");
+    fprintf(c_file, "ml_mat c = ml_matrix(a->rows, a->cols);\n");
+    fprintf(c_file, "for (int64_t i = 0; i < a->rows; i++) {\n");
+    fprintf(c_file, "const double *restrict x = a->data + i * a->stride;\n");
+    fprintf(c_file, "const double *restrict y = b->data + i * b->stride;\n");
+    fprintf(c_file, "double *restrict z = c->data + i * c->stride;\n");
+    fprintf(c_file, "if (operation == 0) for (int64_t j = 0; j < a->cols; j++) z[j] = x[j] + y[j];\n");
+    fprintf(c_file, "else if (operation == 1) for (int64_t j = 0; j < a->cols; j++) z[j] = x[j] - y[j];\n");
+    fprintf(c_file, "else for (int64_t j = 0; j < a->cols; j++) z[j] = x[j] * y[j];\n");
+    fprintf(c_file, "}\n");
+    fprintf(c_file, "return c;\n}\n");
+    fprintf(c_file, "ml_mat ml_madd(ml_mat a, ml_mat b) { return ml_elementwise(a, b, 0); }\n");
+    fprintf(c_file, "ml_mat ml_msub(ml_mat a, ml_mat b) { return ml_elementwise(a, b, 1); }\n");
+    fprintf(c_file, "ml_mat ml_mmul(ml_mat a, ml_mat b) { return ml_elementwise(a, b, 2); }\n");
+    fprintf(c_file, "%sml_mat ml_mscale(ml_mat a, double s) {\n", loop_attribute);
+    fprintf(c_file, "ml_mat c = ml_matrix(ml_checked(a)->rows, a->cols);\n");
+    fprintf(c_file, "for (int64_t i = 0; i < a->rows; i++) {\n");
+    fprintf(c_file, "const double *restrict x = a->data + i * a->stride;\n");
+    fprintf(c_file, "double *restrict z = c->data + i * c->stride;\n");
+    fprintf(c_file, "for (int64_t j = 0; j < a->cols; j++) z[j] = x[j] * s;\n");
+    fprintf(c_file, "}\n");
+    fprintf(c_file, "return c;\n}\n");
+
+    // Printing: one row per line, elements formatted like print
+    fprintf(c_file, "void ml_print_matrix(ml_mat m) {\n");
+    fprintf(c_file, "ml_checked(m);\n");
+    fprintf(c_file, "for (int64_t i = 0; i < m->rows; i++) {\n");
+    fprintf(c_file, "for (int64_t j = 0; j < m->cols; j++) {\n");
+    fprintf(c_file, "double value = m->data[i * m->stride + j];\n");
+    fprintf(c_file, "if (j > 0) putchar(' ');\n");
+    if (print_all_digits) {
+        fprintf(c_file, "printf(\"%%.17g\", value);\n");
+    } else {
+        fprintf(c_file, "if (fabs(value) < 9.2e18 && fabs(value - (int64_t)value) < 1e-6) printf(\"%%\" PRId64, (int64_t)value);\n");
+        fprintf(c_file, "else printf(\"%%.6f\", value);\n");
+    }
+    fprintf(c_file, "}\n");
+    fprintf(c_file, "putchar('\\n');\n");
+    fprintf(c_file, "}\n}\n\n");
+}
+
+/**
+ * Writes the random number runtime. Each thread has a stream given by a 64-bit key and a
+ * counter; the n-th number is the SplitMix64 finalizer applied to key + n * golden ratio, so any
+ * draw can be computed without the ones before it. Streams are keyed by (seed, stream id): the
+ * trial number with --trials, and the iteration index inside parallel repeat blocks, so results
+ * do not depend on how work is spread over threads or processes.
+ * With --trials, print statements record their values for runml to aggregate instead.
+ * @param c_file - The generated C file, or the unit that defines main().
+ */
+void write_random_runtime(FILE *c_file) {
+    if (program_uses_random) {
+        fprintf(c_file, "static _Thread_local ml_random_state ml_random;\n");
+        fprintf(c_file, "static uint64_t ml_random_mix(uint64_t z) {\n");
+        fprintf(c_file, "z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;\n");
+        fprintf(c_file, "z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;\n");
+        fprintf(c_file, "return z ^ (z >> 31);\n}\n");
+        fprintf(c_file, "static uint64_t ml_random_next(void) {\n");
+        fprintf(c_file, "return ml_random_mix(ml_random.key + ++ml_random.counter * 0x9e3779b97f4a7c15ULL);\n}\n");
+        fprintf(c_file, "void ml_random_start(uint64_t seed, uint64_t stream) {\n");
+        fprintf(c_file, "ml_random.key = ml_random_mix(ml_random_mix(seed + 0x9e3779b97f4a7c15ULL) ^ (stream * 0xd1b54a32d192ed03ULL + 1));\n");
+        fprintf(c_file, "ml_random.counter = 0;\n}\n");
+        fprintf(c_file, "uint64_t ml_random_fork(void) { return ml_random_next(); }\n");
+        fprintf(c_file, "ml_random_state ml_random_substream(uint64_t key, int64_t index) {\n");
+        fprintf(c_file, "ml_random_state state = { ml_random_mix(key ^ ((uint64_t)index * 0xd1b54a32d192ed03ULL + 1)), 0 };\n");
+        fprintf(c_file, "return state;\n}\n");
+        fprintf(c_file, "ml_random_state ml_random_swap(ml_random_state next) {\n");
+        fprintf(c_file, "ml_random_state previous = ml_random;\n");
+        fprintf(c_file, "ml_random = next;\n");
+        fprintf(c_file, "return previous;\n}\n");
+        fprintf(c_file, "double ml_rand(void) { return (ml_random_next() >> 11) * 0x1.0p-53; }\n");
+        fprintf(c_file, "double ml_normal(void) {\n");  // Box-Muller; u is in (0, 1) so its log is finite
+        fprintf(c_file, "double u = ((ml_random_next() >> 11) + 0.5) * 0x1.0p-53;\n");
+        fprintf(c_file, "double v = ml_rand();\n");
+        fprintf(c_file, "return sqrt(-2.0 * log(u)) * cos(6.283185307179586 * v);\n}\n");
+    }
+    if (trial_count > 0) {
+        fprintf(c_file, "static int ml_print_index;\n");
+        fprintf(c_file, "void ml_trial_start(void) { ml_print_index = 0; }\n");
+        fprintf(c_file, "void ml_trial_print(double value) { printf(\"%%d %%.17g\\n\", ml_print_index++, value); }\n");
+    }
+    fprintf(c_file, "\n");
+}
+
+/**
+ * Writes the timing runtime behind clock() and bench statements. A bench statement times its
+ * calls in batches; ml_bench_report sorts the per-batch ns/call figures and prints their spread.
+ * @param c_file - The generated C file, or the unit that defines main().
+ */
+void write_timing_runtime(FILE *c_file) {
+    fprintf(c_file, "volatile double ml_bench_sink;\n");
+    fprintf(c_file, "void *volatile ml_bench_pointer_sink;\n");
+    fprintf(c_file, "double ml_clock(void) {\n");
+    fprintf(c_file, "struct timespec now;\n");
+    fprintf(c_file, "clock_gettime(CLOCK_MONOTONIC, &now);\n");
+    fprintf(c_file, "return now.tv_sec + now.tv_nsec * 1e-9;\n}\n");
+    fprintf(c_file, "int64_t ml_bench_sample_count(int64_t calls, int64_t batch) {\n");
+    fprintf(c_file, "int64_t count = calls / batch;\n");
+    fprintf(c_file, "return count < 1 ? 1 : count > %d ? %d : count;\n}\n", BENCH_MAX_SAMPLES, BENCH_MAX_SAMPLES);
+    fprintf(c_file, "static int ml_bench_compare(const void *a, const void *b) {\n");
+    fprintf(c_file, "double x = *(const double *)a, y = *(const double *)b;\n");
+    fprintf(c_file, "return (x > y) - (x < y);\n}\n");
+    fprintf(c_file, "static double ml_bench_percentile(const double *sorted, int64_t count, double fraction) {\n");
+    fprintf(c_file, "int64_t rank = (int64_t)(fraction * count);\n");
+    fprintf(c_file, "if (rank < fraction * count) rank++;\n");  // Nearest rank, without libm
+    fprintf(c_file, "return sorted[rank < 1 ? 0 : rank > count ? count - 1 : rank - 1];\n}\n");
+    fprintf(c_file, "void ml_bench_report(const char *label, double *samples, int64_t count, int64_t batch) {\n");
+    fprintf(c_file, "qsort(samples, count, sizeof(double), ml_bench_compare);\n");
+    fprintf(c_file, "printf(\"bench %%s: %%\" PRId64 \" calls (%%\" PRId64 \" batches), ns/call min %%.2f median %%.2f p90 %%.2f p99 %%.2f max %%.2f\\n\",\n");
+    fprintf(c_file, "label, count * batch, count, samples[0], ml_bench_percentile(samples, count, 0.5),\n");
+    fprintf(c_file, "ml_bench_percentile(samples, count, 0.9), ml_bench_percentile(samples, count, 0.99), samples[count - 1]);\n");
+    fprintf(c_file, "}\n\n");
+}
+
+/**
+ * Writes the line counter array and ml_write_line_counts(), which writes the source with each
+ * line's hit count in front of it ("-" for lines without a counter, such as comments).
+ * The source is embedded as string literals, so the program needs no access to the ml file.
+ * @param c_file - The generated C file, or the unit that defines main().
+ * @param ml_file - The ml source; it is rewound and read to the end.
+ */
+void write_line_counts_runtime(FILE *c_file, FILE *ml_file) {
+    fprintf(c_file, "%suint64_t ml_line_hits[%d];\n", program_uses_parallel ? "_Atomic " : "", source_line_count + 1);
+    fprintf(c_file, "static const char *const ml_source_lines[%d] = {\n", source_line_count + 1);
+    fprintf(c_file, "\"\"");
+    rewind(ml_file);
+    char line[MAX_LINE_LENGTH];
+    for (int n = 1; n <= source_line_count && fgets(line, sizeof(line), ml_file); n++) {
+        line[strcspn(line, "\n")] = '\0';
+        fprintf(c_file, ",\n\"");
+        for (const char *c = line; *c; c++) {
+            if (*c == '"' || *c == '\\') fputc('\\', c_file);
+            if (*c == '\t') fputs("\\t", c_file);
+            else if (isprint((unsigned char)*c)) fputc(*c, c_file);
+        }
+        fputc('"', c_file);
+    }
+    fprintf(c_file, "\n};\n");
+    fprintf(c_file, "static const unsigned char ml_counted_lines[%d] = {", source_line_count + 1);
+    for (int n = 0; n <= source_line_count; n++) {
+        fprintf(c_file, n ? ", %d" : "%d", counted_lines[n]);
+    }
+    fprintf(c_file, "};\n");
+    fprintf(c_file, "void ml_write_line_counts(void) {\n");
+    fprintf(c_file, "FILE *file = fopen(\"");
+    for (const char *c = line_counts_path; *c; c++) {
+        if (*c == '"' || *c == '\\') fputc('\\', c_file);
+        fputc(*c, c_file);
+    }
+    fprintf(c_file, "\", \"w\");\n");
+    fprintf(c_file, "if (!file) return;\n");
+    fprintf(c_file, "for (int n = 1; n < %d; n++) {\n", source_line_count + 1);
+    fprintf(c_file, "if (ml_counted_lines[n]) fprintf(file, \"%%12\" PRIu64 \" %%5d  %%s\\n\", (uint64_t)ml_line_hits[n], n, ml_source_lines[n]);\n");
+    fprintf(c_file, "else fprintf(file, \"%%12s %%5d  %%s\\n\", \"-\", n, ml_source_lines[n]);\n");
+    fprintf(c_file, "}\n");
+    fprintf(c_file, "fclose(file);\n}\n\n");
+}
+
+/**
+ * Writes the runtime behind row input mode. Rows are cut from a large stdin buffer with memchr,
+ * and fields are separated by commas or runs of blanks; with SSE2 the delimiters are found
+ * 16 bytes at a time. Decimal fields with at most 19 digits, a mantissa below 2^53 and a power
+ * of ten within 1e22 are converted with a single exact multiply or divide, which rounds the
+ * same way strtod does; everything else goes to strtod. The column helpers are only written
+ * when the program refers to an argN.
+ * @param c_file - The generated C file, or the unit that defines main().
+ */
+void write_row_input_runtime(FILE *c_file) {
+    fprintf(c_file, "#include <string.h>\n#include <float.h>\n");
+    fprintf(c_file, "#ifdef __SSE2__\n#include <emmintrin.h>\n#endif\n");
+
+    // Rows: the buffer keeps 16 spare bytes so vector loads near its end stay inside it
+    fprintf(c_file, "static char *ml_row_data;\n");
+    fprintf(c_file, "static size_t ml_row_start, ml_row_filled, ml_row_capacity;\n");
+    fprintf(c_file, "static char *ml_next_row(char **row_end) {\n");
+    fprintf(c_file, "for (;;) {\n");
+    fprintf(c_file, "char *newline = ml_row_data ? memchr(ml_row_data + ml_row_start, '\\n', ml_row_filled - ml_row_start) : NULL;\n");
+    fprintf(c_file, "if (newline) {\n");
+    fprintf(c_file, "char *row = ml_row_data + ml_row_start;\n");
+    fprintf(c_file, "ml_row_start = newline - ml_row_data + 1;\n");
+    fprintf(c_file, "*row_end = newline;\n");
+    fprintf(c_file, "return row;\n}\n");
+    fprintf(c_file, "if (ml_row_data) {\n");
+    fprintf(c_file, "memmove(ml_row_data, ml_row_data + ml_row_start, ml_row_filled - ml_row_start);\n");
+    fprintf(c_file, "ml_row_filled -= ml_row_start;\n");
+    fprintf(c_file, "ml_row_start = 0;\n}\n");
+    fprintf(c_file, "if (ml_row_filled == ml_row_capacity) {\n");
+    fprintf(c_file, "size_t capacity = ml_row_capacity ? ml_row_capacity * 2 : (size_t)1 << 20;\n");
+    fprintf(c_file, "char *data = realloc(ml_row_data, capacity + 16);\n");
+    fprintf(c_file, "if (!data) { fprintf(stderr, \"Out of memory reading rows\\n\"); exit(EXIT_FAILURE); }\n");
+    fprintf(c_file, "ml_row_data = data;\n");
+    fprintf(c_file, "ml_row_capacity = capacity;\n}\n");
+    fprintf(c_file, "size_t got = fread(ml_row_data + ml_row_filled, 1, ml_row_capacity - ml_row_filled, stdin);\n");
+    fprintf(c_file, "if (got == 0) {\n");
+    fprintf(c_file, "if (ml_row_filled == 0) return NULL;\n");
+    fprintf(c_file, "*row_end = ml_row_data + ml_row_filled;\n");  // A last row without a newline
+    fprintf(c_file, "ml_row_start = ml_row_filled;\n");
+    fprintf(c_file, "return ml_row_data;\n}\n");
+    fprintf(c_file, "ml_row_filled += got;\n");
+    fprintf(c_file, "}\n}\n\n");
+    if (max_arg_index < 0) {
+        return;  // No columns are read
+    }
+
+    // Delimiters: comma, blank, tab or carriage return
+    fprintf(c_file, "static const char *ml_find_delimiter(const char *p, const char *end) {\n");
+    fprintf(c_file, "#ifdef __SSE2__\n");
+    fprintf(c_file, "const __m128i comma = _mm_set1_epi8(','), blank = _mm_set1_epi8(' '), tab = _mm_set1_epi8('\\t'), cr = _mm_set1_epi8('\\r');\n");
+    fprintf(c_file, "for (; p < end; p += 16) {\n");
+    fprintf(c_file, "__m128i chunk = _mm_loadu_si128((const __m128i *)p);\n");
+    fprintf(c_file, "__m128i hits = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, comma), _mm_cmpeq_epi8(chunk, blank)), _mm_or_si128(_mm_cmpeq_epi8(chunk, tab), _mm_cmpeq_epi8(chunk, cr)));\n");
+    fprintf(c_file, "int mask = _mm_movemask_epi8(hits);\n");
+    fprintf(c_file, "if (mask) return p + __builtin_ctz(mask) < end ? p + __builtin_ctz(mask) : end;\n");
+    fprintf(c_file, "}\n");
+    fprintf(c_file, "return end;\n");
+    fprintf(c_file, "#else\n");
+    fprintf(c_file, "while (p < end && *p != ',' && *p != ' ' && *p != '\\t' && *p != '\\r') p++;\n");
+    fprintf(c_file, "return p;\n");
+    fprintf(c_file, "#endif\n}\n");
+
+    // Numbers: the exact fast path needs double arithmetic without excess precision
+    fprintf(c_file, "static double ml_parse_slow(const char *p, const char *end) {\n");
+    fprintf(c_file, "char small[128];\n");
+    fprintf(c_file, "size_t length = end - p;\n");
+    fprintf(c_file, "char *field = length < sizeof(small) ? small : malloc(length + 1);\n");
+    fprintf(c_file, "if (!field) return 0.0;\n");
+    fprintf(c_file, "memcpy(field, p, length);\n");
+    fprintf(c_file, "field[length] = '\\0';\n");
+    fprintf(c_file, "double value = strtod(field, NULL);\n");
+    fprintf(c_file, "if (field != small) free(field);\n");
+    fprintf(c_file, "return value;\n}\n");
+    fprintf(c_file, "static double ml_parse_number(const char *p, const char *end) {\n");
+    fprintf(c_file, "#if FLT_EVAL_METHOD == 0\n");
+    fprintf(c_file, "static const double powers[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };\n");
+    fprintf(c_file, "const char *s = p;\n");
+    fprintf(c_file, "int negative = 0, digits = 0, seen = 0, exponent = 0;\n");
+    fprintf(c_file, "uint64_t mantissa = 0;\n");
+    fprintf(c_file, "if (s < end && (*s == '-' || *s == '+')) negative = *s++ == '-';\n");
+    fprintf(c_file, "while (s < end && *s == '0') { s++; seen = 1; }\n");
+    fprintf(c_file, "for (; s < end && *s >= '0' && *s <= '9'; s++, seen = 1) {\n");
+    fprintf(c_file, "if (digits++ == 19) return ml_parse_slow(p, end);\n");
+    fprintf(c_file, "mantissa = mantissa * 10 + (*s - '0');\n}\n");
+    fprintf(c_file, "if (s < end && *s == '.') {\n");
+    fprintf(c_file, "s++;\n");
+    fprintf(c_file, "if (digits == 0) for (; s < end && *s == '0'; s++, seen = 1) exponent--;\n");
+    fprintf(c_file, "for (; s < end && *s >= '0' && *s <= '9'; s++, seen = 1, exponent--) {\n");
+    fprintf(c_file, "if (digits++ == 19) return ml_parse_slow(p, end);\n");
+    fprintf(c_file, "mantissa = mantissa * 10 + (*s - '0');\n}\n");
+    fprintf(c_file, "}\n");
+    fprintf(c_file, "if (!seen) return ml_parse_slow(p, end);\n");
+    fprintf(c_file, "if (s < end && (*s == 'e' || *s == 'E')) {\n");
+    fprintf(c_file, "int exponent_negative = 0, exponent_digits = 0, value = 0;\n");
+    fprintf(c_file, "s++;\n");
+    fprintf(c_file, "if (s < end && (*s == '-' || *s == '+')) exponent_negative = *s++ == '-';\n");
+    fprintf(c_file, "for (; s < end && *s >= '0' && *s <= '9' && value < 10000; s++, exponent_digits++) value = value * 10 + (*s - '0');\n");
+    fprintf(c_file, "if (exponent_digits == 0) return ml_parse_slow(p, end);\n");
+    fprintf(c_file, "exponent += exponent_negative ? -value : value;\n}\n");
+    fprintf(c_file, "if (s != end) return ml_parse_slow(p, end);\n");
+    fprintf(c_file, "if (mantissa == 0) return negative ? -0.0 : 0.0;\n");
+    fprintf(c_file, "if (mantissa > (uint64_t)1 << 53 || exponent < -22 || exponent > 22) return ml_parse_slow(p, end);\n");
+    fprintf(c_file, "double value = exponent < 0 ? (double)mantissa / powers[-exponent] : (double)mantissa * powers[exponent];\n");
+    fprintf(c_file, "return negative ? -value : value;\n");
+    fprintf(c_file, "#else\n");
+    fprintf(c_file, "return ml_parse_slow(p, end);\n");
+    fprintf(c_file, "#endif\n}\n");
+
+    // Columns: missing ones read as 0, unused ones are only skipped over
+    fprintf(c_file, "static void ml_split_row(const char *p, const char *end, double *columns, int count, const unsigned char *used) {\n");
+    fprintf(c_file, "for (int c = 0; c < count; c++) {\n");
+    fprintf(c_file, "while (p < end && (*p == ' ' || *p == '\\t')) p++;\n");
+    fprintf(c_file, "const char *field_end = ml_find_delimiter(p, end);\n");
+    fprintf(c_file, "columns[c] = used[c] && field_end > p ? ml_parse_number(p, field_end) : 0.0;\n");
+    fprintf(c_file, "p = field_end;\n");
+    fprintf(c_file, "while (p < end && (*p == ' ' || *p == '\\t' || *p == '\\r')) p++;\n");
+    fprintf(c_file, "if (p < end && *p == ',') p++;\n");
+    fprintf(c_file, "}\n}\n\n");
+}
+
+/**
+ * Returns the libraries the program links against, which follow the objects on the command line.
+ * @return - " -lm" for programs using the random runtime, "" otherwise.
+ */
+const char *program_libraries(void) {
+    return program_uses_random ? " -lm" : "";
+}
+
+/**
+ * Returns the extra compile and link flags for programs with parallel repeat blocks:
+ * -pthread, plus -fopenmp when the compiler can build and link an OpenMP program.
+ * The compiler is probed once per process.
+ * @return - The flags with a leading space, or "" if the program has no parallel blocks.
+ */
+const char *parallel_thread_flags(void) {
+    static int openmp_supported = -1;
+    if (!program_uses_parallel) {
+        return "";
+    }
+    if (openmp_supported < 0) {
+        openmp_supported = system("echo 'int main(void) { return 0; }' | cc -fopenmp -x c -o /dev/null - >/dev/null 2>&1") == 0;
+        debug_log("INFO", "Compiler %s OpenMP\n", openmp_supported ? "supports" : "does not support");
+    }
+    return openmp_supported ? " -pthread -fopenmp" : " -pthread";
+}
+
+/**
+ * Returns the flags that make the C compiler report the loops it vectorized and the calls it
+ * inlined, and those it could not: -fopt-info for GCC, -Rpass for clang. Probed once.
+ * @return The flags, with a leading space, or "" if the compiler has neither.
+ */
+const char *optimization_remark_flags(void) {
+    static const char *flags = NULL;
+    if (!flags) {
+        if (system("echo 'int main(void) { return 0; }' | cc -fopt-info-vec-missed -x c -o /dev/null - >/dev/null 2>&1") == 0) {
+            flags = " -fopt-info-vec-optimized -fopt-info-vec-missed -fopt-info-inline-optimized -fopt-info-inline-missed";
+        } else if (system("echo 'int main(void) { return 0; }' | cc -Rpass=inline -x c -o /dev/null - >/dev/null 2>&1") == 0) {
+            flags = " '-Rpass=inline|loop-vectorize' '-Rpass-missed=inline|loop-vectorize' -Rpass-analysis=loop-vectorize";
+        } else {
+            flags = "";
+        }
+        debug_log("INFO", "Optimization remark flags:%s\n", flags);
+    }
+    return flags;
+}
+
 /**
  * Checks if parentheses are balanced in the given line.
  * @param line - The string containing the code to check.
@@ -198,13 +1193,379 @@ int is_valid_identifier(const char *name) {
     return strlen(name) <= MAX_IDENTIFIER_LENGTH;
 }
 
+/**
+ * Looks up the type of a name visible in the current scope: locals, then visible globals,
+ * then the parameters of the function being translated.
+ * @param name - The identifier.
+ * @return The type, or NULL if the name is unknown or its type is not known yet.
+ */
+char *lookup_variable_type(const char *name) {
+    for (int i = 0; i < local_var_count; i++) {
+        if (strcmp(local_variables[i].name, name) == 0) return local_variables[i].type;
+    }
+    int globals = visible_global_count < 0 ? global_var_count : visible_global_count;
+    for (int i = 0; i < globals; i++) {
+        if (strcmp(global_variables[i].name, name) == 0) return global_variables[i].type;
+    }
+    if (translating_function) {
+        for (int i = 0; i < translating_function->parameter_count; i++) {
+            if (strcmp(translating_function->parameters[i], name) == 0) {
+                return strcmp(translating_function->parameter_types[i], "unknown") == 0 ? NULL : translating_function->parameter_types[i];
+            }
+        }
+    }
+    return NULL;
+}
+
 /**
  * Determines the type of a variable based on its value in the expression.
+ * Integer-only expressions stay exact 64-bit integers; the expression is promoted to double
+ * if any operand is a real literal, a double variable, an argN, or a call that does not
+ * return an integer. Names whose type is not known yet are treated as double.
+ * A matrix variable or a builtin that returns a matrix makes the whole expression a matrix;
+ * an element access a[i, j] is a double.
  * @param value - The value assigned to the variable.
- * @return A string representing the type of the variable ("int" or "double").
+ * @return A string representing the type of the variable ("int64_t", "double" or "ml_mat").
  */
 char *determine_variable_type(const char *value) {
-    return (strchr(value, '.') != NULL) ? "double" : "int";
+    const char *p = value;
+    while (*p) {
+        if (isdigit((unsigned char)*p) || (*p == '.' && isdigit((unsigned char)p[1]))) {
+            // Numeric literal: real if it has a decimal point or an exponent
+            while (isalnum((unsigned char)*p) || *p == '.') {
+                if (*p == '.' || *p == 'e' || *p == 'E') return "double";
+                p++;
+            }
+        } else if (isalpha((unsigned char)*p)) {
+            char name[MAX_LINE_LENGTH];
+            int length = 0;
+            while ((isalnum((unsigned char)*p) || *p == '_') && length < MAX_LINE_LENGTH - 1) {
+                name[length++] = *p++;
+            }
+            name[length] = '\0';
+
+            const char *next = p;
+            while (*next == ' ') next++;
+            const char *type = NULL;
+            if (*next == '[') {
+                return "double";  // Matrix element
+            } else if (*next == '(' && (type = builtin_return_type(name)) != NULL) {
+                if (strcmp(type, "ml_mat") == 0) return "ml_mat";
+                // rows(), cols(), rand() and normal(): the arguments do not make the result a matrix
+                for (int depth = 0; *p; p++) {
+                    if (*p == '(') depth++;
+                    if (*p == ')' && --depth == 0) break;
+                }
+            } else if (*next == '(') {
+                for (int i = 0; i < function_count; i++) {
+                    if (strcmp(functions[i].name, name) == 0) type = functions[i].returns_matrix ? "ml_mat" : functions[i].return_type;
+                }
+                if (type && strcmp(type, "ml_mat") == 0) return "ml_mat";
+            } else {
+                type = lookup_variable_type(name);
+                if (type && strcmp(type, "ml_mat") == 0) return "ml_mat";
+            }
+            if (!type || strcmp(type, "int64_t") != 0) return "double";
+        } else {
+            p++;
+        }
+    }
+    return "int64_t";
+}
+
+/**
+ * Returns the result type of a builtin function.
+ * @param name - The name being called.
+ * @return - "ml_mat", "int64_t" or "double" for a builtin, NULL if it is not one or a user function shadows it.
+ */
+const char *builtin_return_type(const char *name) {
+    for (int i = 0; i < function_count; i++) {
+        if (strcmp(functions[i].name, name) == 0) return NULL;
+    }
+    for (int i = 0; builtin_functions[i]; i++) {
+        if (strcmp(builtin_functions[i], name) == 0) {
+            if (strcmp(name, "rand") == 0 || strcmp(name, "normal") == 0 || strcmp(name, "clock") == 0) return "double";
+            return strcmp(name, "rows") == 0 || strcmp(name, "cols") == 0 ? "int64_t" : "ml_mat";
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Rewrites the parts of an expression that are not plain C: builtin calls become calls to their
+ * ml_ runtime functions and matrix elements a[i, j] become ml_get(a, i, j).
+ * @param expr - The ml expression, already validated.
+ * @param output - Buffer receiving the rewritten expression.
+ * @param size - Size of the output buffer.
+ */
+void rewrite_builtin_calls(const char *expr, char *output, size_t size) {
+    size_t length = 0;
+    while (*expr && length + 1 < size) {
+        if (isalpha((unsigned char)*expr)) {
+            char name[MAX_LINE_LENGTH];
+            int name_length = 0;
+            while ((isalnum((unsigned char)*expr) || *expr == '_') && name_length < MAX_LINE_LENGTH - 1) {
+                name[name_length++] = *expr++;
+            }
+            name[name_length] = '\0';
+            const char *next = expr;
+            while (*next == ' ') next++;
+            if (*next == '[') {
+                length += snprintf(output + length, size - length, "ml_get(%s, ", name);
+                expr = next + 1;
+            } else if (*next == '(' && builtin_return_type(name)) {
+                length += snprintf(output + length, size - length, "ml_%s", name);
+            } else {
+                length += snprintf(output + length, size - length, "%s", name);
+            }
+            if (length >= size) length = size - 1;
+        } else if (isdigit((unsigned char)*expr) || (*expr == '.' && isdigit((unsigned char)expr[1]))) {
+            // Numeric literal; real ones take the f suffix in f32 mode, so arithmetic stays in float
+            size_t literal_length = 0;
+            while (isalnum((unsigned char)expr[literal_length]) || expr[literal_length] == '.') literal_length++;
+            length += snprintf(output + length, size - length, "%.*s%s", (int)literal_length, expr, needs_float_suffix(expr, literal_length) ? "f" : "");
+            if (length >= size) length = size - 1;
+            expr += literal_length;
+        } else {
+            output[length++] = *expr == ']' ? ')' : *expr;
+            expr++;
+        }
+    }
+    output[length] = '\0';
+}
+
+/**
+ * Returns the C type for a type of the translator, where "double" stands for any real value.
+ * @param type - "int64_t", "double", "ml_mat", "void" or a parameter typedef.
+ * @return The type to declare: real values use real_type, the others are unchanged.
+ */
+const char *c_type(const char *type) {
+    return strcmp(type, "double") == 0 ? real_type : type;
+}
+
+/**
+ * Checks whether a numeric literal needs the f suffix: in f32 mode, a real literal is a double
+ * constant that would promote the arithmetic around it to double.
+ * @param literal - The literal.
+ * @param length - Its length.
+ * @return 1 if the suffix is needed, 0 otherwise.
+ */
+int needs_float_suffix(const char *literal, size_t length) {
+    if (strcmp(real_type, "float") != 0) return 0;
+    int real = 0;
+    for (size_t i = 0; i < length; i++) {
+        if (literal[i] == 'x' || literal[i] == 'X' || literal[i] == 'f') return 0;  // Hexadecimal, or already suffixed
+        real |= literal[i] == '.' || literal[i] == 'e' || literal[i] == 'E';
+    }
+    return real;
+}
+
+/**
+ * Flags subtractions at risk of catastrophic cancellation in f32 mode: both operands are real and
+ * neither is a constant, so when their values are close the difference keeps few of float's
+ * 24 significant bits. Each flagged subtraction is reported as a PRECISION warning.
+ * @param expr - The ml expression, already validated.
+ */
+void check_cancellation(const char *expr) {
+    if (strcmp(real_type, "float") != 0) return;
+    for (const char *minus = strchr(expr, '-'); minus; minus = strchr(minus + 1, '-')) {
+        // The operands are the terms on either side, up to the next + or - at the same depth
+        const char *start = minus;
+        int depth = 0;
+        while (start > expr && !(depth == 0 && (strchr("+-,", start[-1]) || (start[-1] == '(')))) {
+            start--;
+            if (*start == ')') depth++;
+            if (*start == '(') depth--;
+        }
+        const char *end = minus + 1;
+        depth = 0;
+        while (*end && !(depth == 0 && (strchr("+-,)", *end)))) {
+            if (*end == '(') depth++;
+            if (*end == ')') depth--;
+            end++;
+        }
+
+        char left[MAX_LINE_LENGTH], right[MAX_LINE_LENGTH];
+        const char *left_end = minus, *right_start = minus + 1;
+        while (start < left_end && *start == ' ') start++;
+        while (left_end > start && left_end[-1] == ' ') left_end--;
+        while (right_start < end && *right_start == ' ') right_start++;
+        while (end > right_start && end[-1] == ' ') end--;
+        snprintf(left, sizeof(left), "%.*s", (int)(left_end - start), start);
+        snprintf(right, sizeof(right), "%.*s", (int)(end - right_start), right_start);
+        int left_variable = 0, right_variable = 0;
+        for (const char *c = left; *c; c++) left_variable |= isalpha((unsigned char)*c);
+        for (const char *c = right; *c; c++) right_variable |= isalpha((unsigned char)*c);
+        if (left[0] == '\0' || !left_variable || !right_variable) {
+            continue;  // A negation, or a constant operand whose digits are known
+        }
+        if (strcmp(determine_variable_type(left), "double") == 0 && strcmp(determine_variable_type(right), "double") == 0) {
+            error_log("PRECISION", "%s - %s may cancel catastrophically in float32; check it with --verify-precision\n", left, right);
+        }
+    }
+}
+
+/**
+ * Returns the number of arguments a builtin function takes.
+ * @param name - The builtin's name.
+ * @return The argument count.
+ */
+int builtin_arity(const char *name) {
+    if (strcmp(name, "rand") == 0 || strcmp(name, "normal") == 0 || strcmp(name, "clock") == 0) return 0;
+    if (strcmp(name, "transpose") == 0 || strcmp(name, "rows") == 0 || strcmp(name, "cols") == 0) return 1;
+    return 2;  // matrix, matmul, madd, msub, mmul and mscale
+}
+
+/**
+ * Checks the names in an expression for --check, which reports what cc would otherwise reject:
+ * calls must name a user function or builtin with the right number of arguments, variables must
+ * be visible, only matrices can be indexed, and matrices cannot be combined with operators.
+ * Does nothing outside --check, where cc reports these.
+ * @param expr - The ml expression.
+ */
+void check_expression(const char *expr) {
+    if (!check_mode) return;
+    check_expression_grammar(expr);
+    const char *p = expr;
+    while (*p) {
+        if (isdigit((unsigned char)*p) || (*p == '.' && isdigit((unsigned char)p[1]))) {
+            while (isalnum((unsigned char)*p) || *p == '.') p++;  // Numeric literal, including exponents
+            continue;
+        }
+        if (!isalpha((unsigned char)*p)) {
+            p++;
+            continue;
+        }
+
+        char name[MAX_LINE_LENGTH];
+        int length = 0;
+        while ((isalnum((unsigned char)*p) || *p == '_') && length < MAX_LINE_LENGTH - 1) {
+            name[length++] = *p++;
+        }
+        name[length] = '\0';
+        const char *next = p;
+        while (*next == ' ') next++;
+
+        if (*next == '(') {
+            // Count the top-level arguments up to the matching parenthesis
+            int arguments = 0, depth = 0, empty = 1;
+            for (const char *c = next; *c; c++) {
+                if (*c == '(' || *c == '[') depth++;
+                else if ((*c == ')' || *c == ']') && --depth == 0) break;
+                else if (*c == ',' && depth == 1) arguments++;
+                else if (*c != ' ') empty = 0;
+            }
+            arguments += !empty;
+
+            const Function *function = NULL;
+            for (int i = 0; i < function_count; i++) {
+                if (strcmp(functions[i].name, name) == 0) function = &functions[i];
+            }
+            if (function && function->parameter_count != arguments) {
+                error_log("SYNTAX", "%s takes %d argument%s but is called with %d: %s\n", name, function->parameter_count, function->parameter_count == 1 ? "" : "s", arguments, expr);
+            } else if (!function && builtin_return_type(name) && builtin_arity(name) != arguments) {
+                error_log("SYNTAX", "%s takes %d argument%s but is called with %d: %s\n", name, builtin_arity(name), builtin_arity(name) == 1 ? "" : "s", arguments, expr);
+            } else if (!function && !builtin_return_type(name)) {
+                error_log("SYNTAX", "Undefined function %s: %s\n", name, expr);
+            }
+            continue;
+        }
+
+        int is_argument = strncmp(name, "arg", 3) == 0 && name[3] && strspn(name + 3, "0123456789") == strlen(name + 3);
+        int visible = is_argument || lookup_variable_type(name) != NULL;
+        for (int i = 0; i < global_var_count && !visible; i++) {
+            visible = strcmp(global_variables[i].name, name) == 0;  // Globals assigned later in main are still declared
+        }
+        for (int i = 0; translating_function && i < translating_function->parameter_count && !visible; i++) {
+            visible = strcmp(translating_function->parameters[i], name) == 0;
+        }
+        if (!check_function_variable_conflict(name)) {
+            error_log("SYNTAX", "Function %s used without a call: %s\n", name, expr);
+        } else if (!visible) {
+            error_log("SYNTAX", "Undefined variable %s: %s\n", name, expr);
+        } else if (*next == '[' && (!lookup_variable_type(name) || strcmp(lookup_variable_type(name), "ml_mat") != 0)) {
+            error_log("SYNTAX", "%s is not a matrix: %s\n", name, expr);
+        }
+    }
+
+    if (strcmp(determine_variable_type(expr), "ml_mat") == 0) {
+        int depth = 0;
+        for (p = expr; *p; p++) {
+            if (*p == '(' || *p == '[') depth++;
+            else if (*p == ')' || *p == ']') depth--;
+            else if (depth == 0 && strchr("+-*/", *p)) {
+                error_log("SYNTAX", "Matrices are combined with madd, msub, mmul or mscale, not operators: %s\n", expr);
+            }
+        }
+    }
+}
+
+/**
+ * Checks the shape of an expression for --check: operands and the operators + - * / alternate,
+ * with at most one sign in front of an operand, brackets pair up, commas only separate call
+ * arguments or indices, and the expression does not end with an operator.
+ * @param expr - The ml expression.
+ */
+void check_expression_grammar(const char *expr) {
+    char brackets[MAX_LINE_LENGTH];  // The open '(' and '[', innermost last
+    int depth = 0;
+    int expect_operand = 1;
+    int signed_operand = 0;  // A sign was just read in front of an operand
+    int call_opened = 0;     // A call's '(' was just read, so ')' may follow for no arguments
+    for (const char *p = expr; *p; p++) {
+        if (*p == ' ') continue;
+        if (expect_operand) {
+            if ((*p == '-' || *p == '+') && !signed_operand) {
+                signed_operand = 1;
+                call_opened = 0;
+                continue;
+            }
+            if (*p == ')' && call_opened) {
+                depth--;
+                call_opened = 0;
+                expect_operand = 0;
+                continue;
+            }
+            if (isdigit((unsigned char)*p) || *p == '.') {
+                while (isalnum((unsigned char)p[1]) || p[1] == '.') p++;
+            } else if (isalpha((unsigned char)*p)) {
+                while (isalnum((unsigned char)p[1]) || p[1] == '_') p++;
+                const char *next = p + 1;
+                while (*next == ' ') next++;
+                if ((*next == '(' || *next == '[') && depth < (int)sizeof(brackets)) {
+                    brackets[depth++] = *next;  // A call or an index: its arguments follow
+                    call_opened = *next == '(';
+                    signed_operand = 0;
+                    p = next;
+                    continue;
+                }
+            } else if (*p == '(' && depth < (int)sizeof(brackets)) {
+                brackets[depth++] = '(';
+                signed_operand = call_opened = 0;
+                continue;
+            } else {
+                error_log("SYNTAX", "Expected an operand before '%c': %s\n", *p, expr);
+                return;
+            }
+            expect_operand = signed_operand = call_opened = 0;
+        } else if (strchr("+-*/", *p) || (*p == ',' && depth > 0)) {
+            expect_operand = 1;
+        } else if (*p == ')' || *p == ']') {
+            if (depth == 0 || brackets[depth - 1] != (*p == ')' ? '(' : '[')) {
+                error_log("SYNTAX", "Unmatched '%c' in expression: %s\n", *p, expr);
+                return;
+            }
+            depth--;
+        } else {
+            error_log("SYNTAX", "Expected an operator before '%s': %s\n", p, expr);
+            return;
+        }
+    }
+    if (expect_operand) {
+        error_log("SYNTAX", "Expression ends without an operand: %s\n", expr);
+    } else if (depth > 0) {
+        error_log("SYNTAX", "Unmatched '%c' in expression: %s\n", brackets[depth - 1], expr);
+    }
 }
 
 /**
@@ -233,32 +1594,122 @@ int check_function_variable_conflict(const char *var_name) {
 }
 
 /**
- * First pass: Parse the ml file to store function definitions and global variables.
- * @param ml_file - FILE pointer to the ml file being parsed.
+ * Checks whether a line of ml code calls the given name.
+ * @param line - A line of ml code.
+ * @param name - The function name.
+ * @return 1 if the name appears as a whole word followed by '(', 0 otherwise.
  */
-void first_pass(FILE *ml_file) {
-    char line[MAX_LINE_LENGTH];
+int line_calls(const char *line, const char *name) {
+    size_t length = strlen(name);
+    for (const char *call = strstr(line, name); call; call = strstr(call + length, name)) {
+        const char *next = call + length;
+        while (*next == ' ') next++;
+        if ((call == line || (!isalnum((unsigned char)call[-1]) && call[-1] != '_')) && *next == '(') {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Records which argN values and non-deterministic constructs a line of ml code refers to.
+ * @param line - A line of ml code.
+ */
+void scan_program_references(const char *line) {
+    if (strncmp(line, "parallel repeat ", 16) == 0) {
+        program_uses_parallel = 1;
+    }
+    if (line_calls(line, "matrix")) {
+        program_uses_matrices = 1;
+    }
+    if (line_calls(line, "rand") || line_calls(line, "normal")) {
+        program_uses_random = 1;
+        program_is_deterministic = 0;  // Results depend on the seed, which is not part of the cache key
+    }
+    const char *statement = line + strspn(line, "\t");
+    if (line_calls(line, "clock") || strncmp(statement, "bench ", 6) == 0) {
+        program_uses_timing = 1;
+        program_is_deterministic = 0;  // Timings differ from run to run
+    }
+
+    const char *p = line;
+    while ((p = strstr(p, "arg")) != NULL) {
+        int at_word_start = (p == line) || (!isalnum((unsigned char)p[-1]) && p[-1] != '_');
+        const char *digits = p + 3;
+        const char *end = digits;
+        while (isdigit((unsigned char)*end)) end++;
+
+        if (at_word_start && end > digits && !isalnum((unsigned char)*end) && *end != '_') {
+            int index = atoi(digits);
+            if (index >= MAX_IDENTIFIERS) {
+                error_log("SYNTAX", "Argument index too large: arg%d\n", index);
+            } else {
+                referenced_args |= (uint64_t)1 << index;
+                if (index > max_arg_index) max_arg_index = index;
+            }
+        }
+        p = end > digits ? end : p + 3;
+    }
+}
+
+/**
+ * Handles one top-level line of the first pass.
+ * @param line - The line, without its newline.
+ * @param ml_file - The ml file, positioned after the line; function bodies are read from it.
+ */
+void first_pass_line(const char *line, FILE *ml_file) {
+    if (line[0] != '#') {
+        scan_program_references(line);
+    }
+
+    if (!check_parentheses_balance(line)) {
+        error_log("SYNTAX", "Unbalanced parentheses in line: %s\n", line);
+        return;
+    }
+
+    if (strncmp(line, "function", 8) == 0) {
+        store_function_definition_and_body(line, ml_file);
+    } else if (line[0] == '\t') {
+        return;  // Body of a parallel repeat block: its variables are private to the block
+    } else if (strstr(line, "<-")) {
+        store_variable(line, 1);  // Store as a global variable
+    }
+}
+
+/**
+ * First pass: Parse the ml file to store function definitions and global variables.
+ * @param ml_file - FILE pointer to the ml file being parsed.
+ */
+void first_pass(FILE *ml_file) {
+    char line[MAX_LINE_LENGTH];
     debug_log("INFO", "Starting first pass to parse global variables and functions\n");
+    source_line_count = 0;
     while (fgets(line, sizeof(line), ml_file)) {
+        source_line_count++;
+        current_ml_line = source_line_count;
         line[strcspn(line, "\n")] = '\0'; // Remove newline character
+        CHECKED_STEP(first_pass_line(line, ml_file));
+    }
+    current_ml_line = 0;
 
-        if (!check_parentheses_balance(line)) {
-            error_log("SYNTAX", "Unbalanced parentheses in line: %s\n", line);
-            continue;
-        }
-
-        if (strncmp(line, "function", 8) == 0) {
-            store_function_definition_and_body(line, ml_file);
-        } else if (strstr(line, "<-")) {
-            store_variable(line, 1);  // Store as a global variable
+    if (line_counts) {
+        free(counted_lines);
+        counted_lines = calloc(source_line_count + 1, 1);
+        if (!counted_lines) {
+            error_log("FILE", "Out of memory for line counts\n");
+            exit(EXIT_FAILURE);
         }
     }
+
+    // Function bodies were only collected; translate them now that all functions are known
+    translate_function_bodies();
     rewind(ml_file);  // Rewind the file for the second pass
 }
 
 /**
  * Stores a function definition after validating its syntax.
  * Ensures all lines in the function body start with exactly one tab character.
+ * The body lines are collected for translate_function_bodies() rather than translated here.
  * 
  * @param line - A string representing the line containing the function definition.
  * @param file - The file pointer to continue reading the function body.
@@ -306,18 +1757,42 @@ void store_function_definition_and_body(const char *line, FILE *file) {
     strcpy(functions[function_count].name, function_name);
     strcpy(functions[function_count].return_type, "void");  // Initially assume void return type
 
-    // Parse the function body
+    // Collect the function body
     char body_line[MAX_LINE_LENGTH];
+    size_t source_size;
     functions[function_count].body[0] = '\0';  // Initialize the body as an empty string
+    functions[function_count].source = NULL;
+    functions[function_count].deferred_calls = NULL;
+    functions[function_count].parallel_code = NULL;
+    functions[function_count].line_numbers = NULL;
+    functions[function_count].visible_globals = global_var_count;
 
-    while (fgets(body_line, sizeof(body_line), file)) {
+    int body_line_count = 0;
+    FILE *source = open_memstream(&functions[function_count].source, &source_size);
+    if (!source) {
+        error_log("FILE", "Out of memory storing function '%s'\n", function_name);
+        exit(EXIT_FAILURE);
+    }
+
+    long line_position;
+    while ((line_position = ftell(file)) >= 0 && fgets(body_line, sizeof(body_line), file)) {
+        source_line_count++;
+        current_ml_line = source_line_count;
         body_line[strcspn(body_line, "\n")] = '\0'; // Remove newline character
 
-        // Detect the end of the function body: an empty line or non-indented line
-        if (strlen(body_line) == 0 || body_line[0] != '\t') {
+        // A top-level line ends the body and is left unread for first_pass(), as generate_main_code()
+        // leaves it; it may be followed by tab-indented lines of its own, such as a parallel repeat body
+        if (body_line[0] != '\0' && !isspace((unsigned char)body_line[0])) {
+            fseek(file, line_position, SEEK_SET);
+            source_line_count--;
+            break;
+        }
+
+        // An empty or space-indented line is only the end if no indented lines follow it
+        if (body_line[0] != '\t') {
             // Peek the next two lines to check if we are outside the function
-            char next_line_1[MAX_LINE_LENGTH];
-            char next_line_2[MAX_LINE_LENGTH];
+            char next_line_1[MAX_LINE_LENGTH] = "";
+            char next_line_2[MAX_LINE_LENGTH] = "";
 
             long current_pos = ftell(file);  // Save current position
 
@@ -340,28 +1815,566 @@ void store_function_definition_and_body(const char *line, FILE *file) {
             continue;  // Move on to the next line
         }
 
+        scan_program_references(body_line + 1);
+
         // Check for return statements and track their presence
         if (strncmp(body_line + 1, "return", 6) == 0) {
             has_return_statement = 1;  // Mark that a return statement is found
         }
 
-        // Translate the line before adding it to the body
-        FILE *temp_body = fopen("temp_body.c", "w+");
-        generate_c_code(body_line + 1, temp_body);  // Skip the leading tab character
-        fseek(temp_body, 0, SEEK_SET);  // Rewind the file to read its content
-
-        char translated_line[MAX_LINE_LENGTH];
-        while (fgets(translated_line, sizeof(translated_line), temp_body)) {
-            strcat(functions[function_count].body, translated_line);
+        fprintf(source, "%s\n", body_line + 1);  // Skip the leading tab character
+        int *line_numbers = realloc(functions[function_count].line_numbers, (body_line_count + 1) * sizeof(int));
+        if (!line_numbers) {
+            error_log("FILE", "Out of memory storing function '%s'\n", function_name);
+            exit(EXIT_FAILURE);
         }
-
-        fclose(temp_body);
+        line_numbers[body_line_count++] = source_line_count;
+        functions[function_count].line_numbers = line_numbers;
     }
 
+    fclose(source);
     functions[function_count].has_return_statement = has_return_statement;  // Store return presence
+    infer_matrix_signature(&functions[function_count]);
+    find_specialization_forms(&functions[function_count]);
     function_count++;
 }
 
+/**
+ * Finds the matrix parts of a function's signature from its collected body: parameters indexed
+ * as m[i, j] or passed as a matrix operand of a builtin are matrices, and the function returns a
+ * matrix if a return expression is one. The body's assignments are typed in order, as
+ * translation will type them.
+ * @param func - The function, with its body lines in source.
+ */
+void infer_matrix_signature(Function *func) {
+    // Matrix operands of builtins: every argument, except the factor of mscale and the sizes of matrix
+    for (const char *open = strchr(func->source, '('); open; open = strchr(open + 1, '(')) {
+        const char *start = open;
+        while (start > func->source && isalnum((unsigned char)start[-1])) start--;
+        char name[MAX_IDENTIFIER_LENGTH + 1];
+        snprintf(name, sizeof(name), "%.*s", (int)(open - start), start);
+        if (!builtin_return_type(name) || strcmp(name, "matrix") == 0 || strcmp(builtin_return_type(name), "double") == 0) continue;
+
+        const char *argument = open + 1;
+        for (int index = 0, depth = 0; *argument && depth >= 0; index++) {
+            while (*argument == ' ') argument++;
+            const char *end = argument;
+            while (*end && (depth > 0 || (*end != ',' && *end != ')'))) {
+                if (*end == '(') depth++;
+                if (*end == ')') depth--;
+                end++;
+            }
+            const char *trimmed = end;
+            while (trimmed > argument && trimmed[-1] == ' ') trimmed--;
+            for (int j = 0; j < func->parameter_count && !(strcmp(name, "mscale") == 0 && index == 1); j++) {
+                if ((size_t)(trimmed - argument) == strlen(func->parameters[j]) && strncmp(argument, func->parameters[j], trimmed - argument) == 0) {
+                    strcpy(func->parameter_types[j], "ml_mat");
+                }
+            }
+            if (*end != ',') break;
+            argument = end + 1;
+        }
+    }
+
+    for (int j = 0; j < func->parameter_count; j++) {
+        size_t length = strlen(func->parameters[j]);
+        for (const char *use = strstr(func->source, func->parameters[j]); use; use = strstr(use + length, func->parameters[j])) {
+            const char *next = use + length;
+            while (*next == ' ') next++;
+            if ((use == func->source || (!isalnum((unsigned char)use[-1]) && use[-1] != '_')) && *next == '[') {
+                strcpy(func->parameter_types[j], "ml_mat");
+                break;
+            }
+        }
+    }
+
+    func->returns_matrix = 0;
+    translating_function = func;
+    local_var_count = 0;
+    for (const char *line = func->source; line && *line; line = strchr(line, '\n') + 1) {
+        char identifier[MAX_IDENTIFIER_LENGTH];
+        char expression[MAX_LINE_LENGTH];
+        while (*line == '\t') line++;  // Lines of parallel repeat blocks
+        if (sscanf(line, "%11s <- %255[^\n]", identifier, expression) == 2 && !lookup_variable_type(identifier) && local_var_count < MAX_IDENTIFIERS) {
+            strcpy(local_variables[local_var_count].name, identifier);
+            strcpy(local_variables[local_var_count].type, determine_variable_type(expression));
+            local_var_count++;
+        } else if (sscanf(line, "return %255[^\n]", expression) == 1 && strcmp(determine_variable_type(expression), "ml_mat") == 0) {
+            func->returns_matrix = 1;
+        }
+    }
+    translating_function = NULL;
+    local_var_count = 0;
+}
+
+/**
+ * Finds how constant call sites of a function can be specialized. A body that is only
+ * "return <expression>" over the parameters and numeric literals can be folded into the caller;
+ * other functions are cloned unless they take or return matrices or contain a parallel repeat,
+ * whose outlined blocks belong to the original.
+ * @param func - The function, with its body lines in source and its matrix signature inferred.
+ */
+void find_specialization_forms(Function *func) {
+    for (int i = 0; i < func->clone_count; i++) {
+        free(func->clones[i]);
+    }
+    free(func->clones);
+    free(func->fold_expression);
+    func->clones = NULL;
+    func->clone_count = 0;
+    func->emitted_clone_count = 0;
+    func->folded = 0;
+    func->fold_expression = NULL;
+
+    func->specializable = func->parameter_count > 0 && !func->returns_matrix && func->source && !strstr(func->source, "parallel repeat ");
+    for (int i = 0; i < func->parameter_count; i++) {
+        if (strcmp(func->parameter_types[i], "ml_mat") == 0) func->specializable = 0;
+    }
+    if (!func->specializable || strncmp(func->source, "return ", 7) != 0 || strchr(func->source, '\n')[1] != '\0') {
+        return;
+    }
+
+    const char *expression = func->source + 7;
+    for (const char *p = expression; *p != '\n'; ) {
+        if (isalpha((unsigned char)*p)) {
+            const char *start = p;
+            while (isalnum((unsigned char)*p) || *p == '_') p++;
+            int parameter = 0;
+            for (int i = 0; i < func->parameter_count; i++) {
+                parameter |= strlen(func->parameters[i]) == (size_t)(p - start) && strncmp(func->parameters[i], start, p - start) == 0;
+            }
+            if (!parameter) return;  // Globals, argN and calls are not constant
+        } else if (isdigit((unsigned char)*p) || *p == '.') {
+            while (isalnum((unsigned char)*p) || *p == '.') p++;
+        } else if (strchr("+-*/() ", *p)) {
+            p++;
+        } else {
+            return;
+        }
+    }
+    func->fold_expression = strndup(expression, strchr(expression, '\n') - expression);
+}
+
+/**
+ * Checks whether text is a plain decimal numeric literal, such as 12, 2.5 or 1e6.
+ * @param literal - The text.
+ * @param length - Its length.
+ * @return 1 if it is, 0 otherwise.
+ */
+int is_numeric_literal(const char *literal, size_t length) {
+    if (length == 0 || (!isdigit((unsigned char)literal[0]) && literal[0] != '.')) return 0;
+    for (size_t i = 0; i < length; i++) {
+        if (!isdigit((unsigned char)literal[i]) && !strchr(".eE", literal[i])) return 0;
+    }
+    char *end;
+    char text[MAX_LINE_LENGTH];
+    snprintf(text, sizeof(text), "%.*s", (int)length, literal);
+    strtod(text, &end);
+    return *end == '\0';
+}
+
+/**
+ * Evaluates a fold expression for constant arguments, to make sure folding it cannot make cc reject
+ * the program: a division by zero or an integer overflow in a constant expression is an error under
+ * -Werror, where the call would only have failed at run time. Values are kept within 2^53.
+ * @param expr - Position in the expression, advanced past what was evaluated.
+ * @param func - The function, for its parameter names.
+ * @param values - The argument values.
+ * @param integer - Whether to divide as integers do, truncating.
+ * @param level - 0 for a sum, 1 for a product, 2 for a factor.
+ * @param valid - Cleared if the value is out of range or a divisor is zero.
+ * @return The value.
+ */
+double evaluate_fold(const char **expr, const Function *func, const double *values, int integer, int level, int *valid) {
+    while (**expr == ' ') (*expr)++;
+    double value = 0;
+    if (level == 2) {
+        if (**expr == '-') {
+            (*expr)++;
+            value = -evaluate_fold(expr, func, values, integer, 2, valid);
+        } else if (**expr == '(') {
+            (*expr)++;
+            value = evaluate_fold(expr, func, values, integer, 0, valid);
+            while (**expr == ' ') (*expr)++;
+            if (**expr == ')') (*expr)++;
+        } else if (isalpha((unsigned char)**expr)) {
+            const char *start = *expr;
+            while (isalnum((unsigned char)**expr) || **expr == '_') (*expr)++;
+            for (int i = 0; i < func->parameter_count; i++) {
+                if (strlen(func->parameters[i]) == (size_t)(*expr - start) && strncmp(func->parameters[i], start, *expr - start) == 0) value = values[i];
+            }
+        } else {
+            char *end;
+            value = strtod(*expr, &end);
+            *expr = end;
+        }
+    } else {
+        value = evaluate_fold(expr, func, values, integer, level + 1, valid);
+        for (;;) {
+            while (**expr == ' ') (*expr)++;
+            char operator = **expr;
+            if (!(level == 0 ? operator == '+' || operator == '-' : operator == '*' || operator == '/')) break;
+            (*expr)++;
+            double operand = evaluate_fold(expr, func, values, integer, level + 1, valid);
+            if (operator == '+') value += operand;
+            if (operator == '-') value -= operand;
+            if (operator == '*') value *= operand;
+            if (operator == '/') {
+                if (operand == 0 || (integer && operand > -1 && operand < 1)) *valid = 0;
+                value = *valid ? value / operand : 0;
+                if (integer) value = (double)(int64_t)value;
+            }
+        }
+    }
+    if (!(value > -9007199254740992.0 && value < 9007199254740992.0)) *valid = 0;
+    return value;
+}
+
+/**
+ * Records that a function is called with a tuple of constant arguments, so a clone is emitted for it.
+ * Bodies are translated concurrently, so the clone lists are shared under specialization_lock.
+ * @param func - The function.
+ * @param arguments - The literals, comma-separated.
+ * @return 1 if the clone exists, 0 if the function already has MAX_FUNCTION_CLONES of them.
+ */
+int register_clone(Function *func, const char *arguments) {
+    pthread_mutex_lock(&specialization_lock);
+    int found = 0;
+    for (int i = 0; i < func->clone_count && !found; i++) {
+        found = strcmp(func->clones[i], arguments) == 0;
+    }
+    if (!found && func->clone_count < MAX_FUNCTION_CLONES) {
+        char **clones = realloc(func->clones, (func->clone_count + 1) * sizeof(char *));
+        if (clones) {
+            func->clones = clones;
+            func->clones[func->clone_count++] = strdup(arguments);
+            found = 1;
+        }
+    }
+    pthread_mutex_unlock(&specialization_lock);
+    return found;
+}
+
+/**
+ * Rewrites calls to user functions whose arguments are all numeric literals. A function whose body
+ * only returns an expression of its parameters becomes its ml_fold_ macro, a constant expression cc
+ * evaluates even without optimization; any other becomes a call to its clone for those arguments,
+ * <name>__s<arguments>(), in which the parameters are constants.
+ * @param expr - The ml expression, already validated.
+ * @param output - Buffer receiving the rewritten expression.
+ * @param size - Size of the output buffer.
+ * @param allow_fold - Whether calls may fold; a call statement must remain a statement with an effect.
+ * @return 1 if the expression was rewritten, 0 if it is unchanged or would not fit.
+ */
+int specialize_constant_calls(const char *expr, char *output, size_t size, int allow_fold) {
+    if (!specialize_calls || emitting_bench_call) {
+        return 0;
+    }
+    size_t length = 0;
+    int changed = 0;
+    while (*expr) {
+        if (!isalpha((unsigned char)*expr)) {
+            if (length + 1 >= size) return 0;
+            output[length++] = *expr++;
+            continue;
+        }
+        const char *name = expr;
+        while (isalnum((unsigned char)*expr) || *expr == '_') expr++;
+        int name_length = (int)(expr - name);
+        const char *open = expr;
+        while (*open == ' ') open++;
+
+        Function *func = NULL;
+        for (int i = 0; i < function_count && *open == '('; i++) {
+            if (strlen(functions[i].name) == (size_t)name_length && strncmp(functions[i].name, name, name_length) == 0) func = &functions[i];
+        }
+
+        // Collect the arguments if every one is a literal
+        char arguments[MAX_LINE_LENGTH] = "";
+        double values[MAX_IDENTIFIERS];
+        int argument_count = 0;
+        const char *close = open + 1;
+        int constant = func && func->specializable;
+        while (constant) {
+            while (*close == ' ') close++;
+            const char *end = close + strcspn(close, ",()");
+            const char *trimmed = end;
+            while (trimmed > close && trimmed[-1] == ' ') trimmed--;
+            if (*end == '(' || *end == '\0' || argument_count >= MAX_IDENTIFIERS || !is_numeric_literal(close, trimmed - close)) {
+                constant = 0;
+                break;
+            }
+            values[argument_count++] = strtod(close, NULL);
+            snprintf(arguments + strlen(arguments), sizeof(arguments) - strlen(arguments), "%s%.*s", argument_count > 1 ? "," : "", (int)(trimmed - close), close);
+            close = end + 1;
+            if (*end == ')') break;
+        }
+
+        char replacement[MAX_LINE_LENGTH * 2];
+        replacement[0] = '\0';
+        if (constant && argument_count == func->parameter_count) {
+            int valid = 1;
+            if (allow_fold && func->fold_expression && !line_counts) {
+                const char *position = func->fold_expression;
+                evaluate_fold(&position, func, values, 0, 0, &valid);
+                position = func->fold_expression;
+                evaluate_fold(&position, func, values, 1, 0, &valid);
+            }
+            if (allow_fold && func->fold_expression && !line_counts && valid) {
+                pthread_mutex_lock(&specialization_lock);
+                if (!func->folded) func->folded = 1;
+                pthread_mutex_unlock(&specialization_lock);
+                snprintf(replacement, sizeof(replacement), "ml_fold_%s(%s)", func->name, arguments);
+            } else if (register_clone(func, arguments)) {
+                snprintf(replacement, sizeof(replacement), "%s__s", func->name);
+                for (const char *c = arguments; *c; c++) {
+                    size_t end = strlen(replacement);
+                    if (end + 3 >= sizeof(replacement)) return 0;
+                    replacement[end] = *c == ',' ? '_' : *c == '.' ? 'p' : *c;
+                    replacement[end + 1] = '\0';
+                }
+                strcat(replacement, "()");
+            }
+        }
+
+        if (replacement[0]) {
+            if (length + strlen(replacement) >= size) return 0;
+            strcpy(output + length, replacement);
+            length += strlen(replacement);
+            expr = close;
+            changed = 1;
+        } else {
+            if (length + name_length >= size) return 0;
+            memcpy(output + length, name, name_length);
+            length += name_length;
+        }
+    }
+    output[length] = '\0';
+    return changed;
+}
+
+/**
+ * Writes the declarations of a function's specializations found since the last call: the ml_fold_
+ * macro and the clone prototypes. The clones are sorted, so the generated C does not depend on
+ * which thread translated which body.
+ * @param output_file - The file pointer to write the declarations to.
+ * @param func - The function, with its final signature.
+ */
+void write_specialization_declarations(FILE *output_file, Function *func) {
+    if (func->folded == 1) {
+        fprintf(output_file, "#define ml_fold_%s(", func->name);
+        for (int i = 0; i < func->parameter_count; i++) {
+            fprintf(output_file, i ? ", %s" : "%s", func->parameters[i]);
+        }
+        fprintf(output_file, ") ((%s)(", c_type(func->return_type));
+        for (const char *p = func->fold_expression; *p; ) {
+            if (isalpha((unsigned char)*p)) {
+                const char *start = p;
+                while (isalnum((unsigned char)*p) || *p == '_') p++;
+                for (int i = 0; i < func->parameter_count; i++) {
+                    if (strlen(func->parameters[i]) == (size_t)(p - start) && strncmp(func->parameters[i], start, p - start) == 0) {
+                        fprintf(output_file, "((%s)(%s))", c_type(func->parameter_types[i]), func->parameters[i]);
+                    }
+                }
+            } else if (isdigit((unsigned char)*p) || *p == '.') {
+                size_t length = 0;
+                while (isalnum((unsigned char)p[length]) || p[length] == '.') length++;
+                fprintf(output_file, "%.*s%s", (int)length, p, needs_float_suffix(p, length) ? "f" : "");
+                p += length;
+            } else {
+                fputc(*p++, output_file);
+            }
+        }
+        fprintf(output_file, "))\n");
+        func->folded = 2;
+    }
+
+    qsort(func->clones + func->emitted_clone_count, func->clone_count - func->emitted_clone_count, sizeof(char *), compare_strings);
+    for (int i = func->emitted_clone_count; i < func->clone_count; i++) {
+        fprintf(output_file, "%s %s__s", c_type(func->return_type), func->name);
+        for (const char *c = func->clones[i]; *c; c++) {
+            fputc(*c == ',' ? '_' : *c == '.' ? 'p' : *c, output_file);
+        }
+        fprintf(output_file, "(void);\n");
+    }
+}
+
+/**
+ * Writes the definitions of the clones declared by write_specialization_declarations(): the
+ * function's translated body, with each parameter a constant local.
+ * @param output_file - The file pointer to write the definitions to.
+ * @param func - The function, with its final signature and translated body.
+ */
+void write_specialization_definitions(FILE *output_file, Function *func) {
+    for (int i = func->emitted_clone_count; i < func->clone_count; i++) {
+        fprintf(output_file, "%s %s__s", c_type(func->return_type), func->name);
+        for (const char *c = func->clones[i]; *c; c++) {
+            fputc(*c == ',' ? '_' : *c == '.' ? 'p' : *c, output_file);
+        }
+        fprintf(output_file, "(void) {\n");
+        const char *value = func->clones[i];
+        for (int j = 0; j < func->parameter_count; j++) {
+            size_t value_length = strcspn(value, ",");
+            fprintf(output_file, "const %s %s = %.*s%s;\n(void)%s;\n", c_type(func->parameter_types[j]), func->parameters[j], (int)value_length, value,
+                    needs_float_suffix(value, value_length) ? "f" : "", func->parameters[j]);
+            value += value_length + (value[value_length] == ',');
+        }
+        fprintf(output_file, "%s", func->body);
+        if (!func->has_return_statement && strcmp(func->return_type, "void") != 0) {
+            fprintf(output_file, "return 0;\n");
+        }
+        fprintf(output_file, "}\n\n");
+    }
+    func->emitted_clone_count = func->clone_count;
+}
+
+/**
+ * Makes the return type agree with what the body returns: matrices only if a return expression
+ * is a matrix, since the first parameter being a matrix does not make the result one.
+ * @param func - The function whose return type was just set.
+ */
+void settle_matrix_return_type(Function *func) {
+    if (func->returns_matrix) {
+        strcpy(func->return_type, "ml_mat");
+    } else if (strcmp(func->return_type, "ml_mat") == 0) {
+        strcpy(func->return_type, "double");
+    }
+}
+
+/**
+ * Translates the collected body of one function into C.
+ * Runs with a private scope and its own output buffer, so bodies can be translated concurrently;
+ * only the globals defined before the function are visible, and call statements are recorded
+ * for translate_function_bodies() to resolve afterwards.
+ * @param index - Index of the function in the functions array.
+ */
+void translate_function_body(int index) {
+    Function *func = &functions[index];
+    char *translated = NULL;
+    size_t translated_size = 0;
+    FILE *output = open_memstream(&translated, &translated_size);
+    if (!output) {
+        error_log("FILE", "Out of memory translating function '%s'\n", func->name);
+        exit(EXIT_FAILURE);
+    }
+
+    size_t parallel_size;
+    parallel_code_file = open_memstream(&func->parallel_code, &parallel_size);
+    parallel_block_count = 0;
+
+    translating_function = func;
+    visible_global_count = func->visible_globals;
+    local_var_count = 0;  // Each function has its own scope
+
+    char *line = func->source;
+    int body_line = 0;
+    while (line && *line) {
+        char *end = strchr(line, '\n');
+        *end = '\0';
+        current_ml_line = func->line_numbers[body_line++];
+        if (strncmp(line, "parallel repeat ", 16) == 0) {
+            // The block body is the following run of lines indented by a further tab
+            char *body = NULL;
+            size_t body_size;
+            FILE *body_file = open_memstream(&body, &body_size);
+            const char *header = line;
+            line = end + 1;
+            while (*line == '\t') {
+                end = strchr(line, '\n');
+                fprintf(body_file, "%.*s", (int)(end - line), line + 1);
+                line = end + 1;
+                body_line++;
+            }
+            fclose(body_file);
+            CHECKED_STEP(generate_parallel_repeat(header, body, output));
+            free(body);
+            continue;
+        }
+        CHECKED_STEP(generate_c_code(line, output));
+        line = end + 1;
+    }
+    current_ml_line = 0;
+    free(func->line_numbers);
+    func->line_numbers = NULL;
+    fclose(output);
+    fclose(parallel_code_file);
+    parallel_code_file = NULL;
+
+    translating_function = NULL;
+    visible_global_count = -1;
+    local_var_count = 0;
+
+    if (translated_size >= sizeof(func->body)) {
+        error_log("SYNTAX", "Function '%s' is too long.\n", func->name);
+    }
+    memcpy(func->body, translated, translated_size + 1);
+    free(translated);
+    free(func->source);
+    func->source = NULL;
+}
+
+/**
+ * Worker thread for translate_function_bodies(): claims functions one at a time.
+ * @param argument - Shared counter of the next function to translate, protected by its mutex.
+ * @return - NULL.
+ */
+void *function_translation_thread(void *argument) {
+    static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    int *next = argument;
+    for (;;) {
+        pthread_mutex_lock(&lock);
+        int index = (*next)++;
+        pthread_mutex_unlock(&lock);
+        if (index >= function_count) {
+            return NULL;
+        }
+        translate_function_body(index);
+    }
+}
+
+/**
+ * Translates every collected function body. Programs with at least PARALLEL_PARSE_THRESHOLD
+ * functions are translated on one thread per core; the results land in each function's own
+ * body buffer, so source order is kept. Call statements found in bodies are then applied to
+ * parameter types in source order, each seeing only the functions defined before it.
+ */
+void translate_function_bodies(void) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int thread_count = cores < function_count ? (int)cores : function_count;
+
+    // Errors are only recoverable on this thread, so --check and --precompile translate serially
+    if (function_count >= PARALLEL_PARSE_THRESHOLD && thread_count > 1 && !check_mode && !check_recovery) {
+        debug_log("INFO", "Translating %d function bodies on %d threads\n", function_count, thread_count);
+        pthread_t threads[thread_count];
+        int next = 0;
+        int started = 0;
+        while (started < thread_count && pthread_create(&threads[started], NULL, function_translation_thread, &next) == 0) {
+            started++;
+        }
+        function_translation_thread(&next);  // Whatever the started threads have not claimed, including all of it if none started
+        for (int i = 0; i < started; i++) {
+            pthread_join(threads[i], NULL);
+        }
+    } else {
+        for (int i = 0; i < function_count; i++) {
+            translate_function_body(i);
+        }
+    }
+
+    // Resolve the recorded call statements in source order
+    for (int i = 0; i < function_count; i++) {
+        char *call = functions[i].deferred_calls;
+        while (call && *call) {
+            char *end = strchr(call, '\n');
+            *end = '\0';
+            determine_parameter_types(call, i);
+            call = end + 1;
+        }
+        free(functions[i].deferred_calls);
+        functions[i].deferred_calls = NULL;
+    }
+}
+
 /**
  * Stores a variable and validates its name and type. 
  * Variables are stored either globally or locally.
@@ -391,6 +2404,14 @@ void store_variable(const char *line, int is_global) {
             return;
         }
 
+        // Each global is defined once in C, so main cannot assign it a second time
+        for (int i = 0; is_global && i < global_var_count; i++) {
+            if (strcmp(global_variables[i].name, identifier) == 0) {
+                error_log("SYNTAX", "Global variable %s is assigned more than once at top level\n", identifier);
+                return;
+            }
+        }
+
         type = determine_variable_type(expression);
         Variable *var_array = is_global ? global_variables : local_variables;
         int *var_count = is_global ? &global_var_count : &local_var_count;
@@ -421,14 +2442,120 @@ void second_pass(FILE *ml_file, FILE *c_file) {
     // Generate function prototypes and code
     generate_function_prototypes_and_code(c_file);
 
+    // main() is buffered so the parallel blocks it outlines can be written ahead of it;
+    // when compiling in several units, it is also kept for the first unit
+    char *main_code = NULL;
+    char *main_parallel_code = NULL;
+    size_t main_size, parallel_size;
+    FILE *main_file = open_memstream(&main_code, &main_size);
+    parallel_code_file = open_memstream(&main_parallel_code, &parallel_size);
+    parallel_block_count = 0;
+    if (!main_file || !parallel_code_file) {
+        error_log("FILE", "Out of memory generating main()\n");
+        exit(EXIT_FAILURE);
+    }
+
     // Start the main function
-    fprintf(c_file, "int main(int argc, char *argv[]) {\n");
+    fprintf(main_file, "int main(int argc, char *argv[]) {\n");
+
+    if (program_uses_random) {
+        fprintf(main_file, "uint64_t ml_seed = getenv(\"RUNML_SEED\") ? strtoull(getenv(\"RUNML_SEED\"), NULL, 0) : 0;\n");
+    }
+    if (trial_count > 0) {
+        // runml gives each process a contiguous range of trials; every trial starts from zeroed globals
+        fprintf(main_file, "uint64_t ml_first_trial = 0, ml_trial_count = 1;\n");
+        fprintf(main_file, "if (getenv(\"RUNML_TRIALS\")) sscanf(getenv(\"RUNML_TRIALS\"), \"%%\" SCNu64 \" %%\" SCNu64, &ml_first_trial, &ml_trial_count);\n");
+        fprintf(main_file, "for (uint64_t ml_trial = ml_first_trial; ml_trial < ml_first_trial + ml_trial_count; ml_trial++) {\n");
+        fprintf(main_file, "ml_trial_start();\n");
+        for (int i = 0; i < global_var_count; i++) {
+            fprintf(main_file, "%s = 0;\n", global_variables[i].name);
+        }
+        if (program_uses_random) {
+            fprintf(main_file, "ml_random_start(ml_seed, ml_trial);\n");
+        }
+    } else if (program_uses_random) {
+        fprintf(main_file, "ml_random_start(ml_seed, 0);\n");
+    }
+
+    if (row_input) {
+        // Each stdin row runs the program once; only the columns it refers to are converted
+        fprintf(main_file, "char *ml_row;\nchar *ml_row_end;\n");
+        if (max_arg_index >= 0) {
+            fprintf(main_file, "static const unsigned char ml_used_columns[%d] = {", max_arg_index + 1);
+            for (int i = 0; i <= max_arg_index; i++) {
+                fprintf(main_file, i ? ", %d" : "%d", (int)(referenced_args >> i & 1));
+            }
+            fprintf(main_file, "};\ndouble ml_columns[%d];\n", max_arg_index + 1);
+        }
+        fprintf(main_file, "(void)argc;\n(void)argv;\n");
+        fprintf(main_file, "while ((ml_row = ml_next_row(&ml_row_end)) != NULL) {\n");
+        if (max_arg_index >= 0) {
+            fprintf(main_file, "ml_split_row(ml_row, ml_row_end, ml_columns, %d, ml_used_columns);\n", max_arg_index + 1);
+        }
+        for (int i = 0; i <= max_arg_index; i++) {
+            if (referenced_args >> i & 1) {
+                fprintf(main_file, "arg%d = ml_columns[%d];\n", i, i);
+            }
+        }
+    } else if (!constant_arguments) {
+        // Command-line arguments are parsed as real numbers into arg0, arg1, ...
+        for (int i = 0; i <= max_arg_index; i++) {
+            fprintf(main_file, "if (argc > %d) arg%d = atof(argv[%d]);\n", i + 1, i, i + 1);
+        }
+    }
 
     // Generate the main function code
-    generate_main_code(ml_file, c_file);
+    generate_main_code(ml_file, main_file);
+    if (row_input || trial_count > 0) {
+        fprintf(main_file, "}\n");
+    }
 
     // Close the main function in the C file
-    fprintf(c_file, "return 0;\n}\n");
+    if (line_counts) {
+        fprintf(main_file, "ml_write_line_counts();\n");
+    }
+    fprintf(main_file, "return 0;\n}\n");
+    fclose(main_file);
+    fclose(parallel_code_file);
+    parallel_code_file = NULL;
+
+    free(generated_main);
+    generated_main = NULL;
+    FILE *combined = open_memstream(&generated_main, &main_size);
+    if (!combined) {
+        error_log("FILE", "Out of memory generating main()\n");
+        exit(EXIT_FAILURE);
+    }
+    if (program_uses_parallel) {
+        write_parallel_runtime(combined);
+    }
+    if (row_input) {
+        write_row_input_runtime(combined);
+    }
+    if (program_uses_matrices) {
+        write_matrix_runtime(combined);
+    }
+    if (program_uses_random || trial_count > 0) {
+        write_random_runtime(combined);
+    }
+    if (program_uses_timing) {
+        write_timing_runtime(combined);
+    }
+    if (line_counts) {
+        write_line_counts_runtime(combined, ml_file);
+    }
+    for (int i = 0; i < function_count; i++) {
+        // Specializations first needed by main()
+        write_specialization_declarations(combined, &functions[i]);
+        write_specialization_definitions(combined, &functions[i]);
+    }
+    fputs(main_parallel_code, combined);
+    fputs(main_code, combined);
+    fclose(combined);
+    free(main_parallel_code);
+    free(main_code);
+
+    fputs(generated_main, c_file);
 }
 
 /**
@@ -437,35 +2564,66 @@ void second_pass(FILE *ml_file, FILE *c_file) {
  */
 void generate_global_variables(FILE *output_file) {
     for (int i = 0; i < global_var_count; i++) {
-        fprintf(output_file, "%s %s = 0.0;\n", global_variables[i].type, global_variables[i].name);
+        const char *initial = strcmp(global_variables[i].type, "ml_mat") == 0 ? "0" : "0.0";  // Matrices start unassigned
+        fprintf(output_file, "%s %s = %s;\n", c_type(global_variables[i].type), global_variables[i].name, initial);
+    }
+    for (int i = 0; i <= max_arg_index; i++) {
+        if (constant_arguments) {
+            fprintf(output_file, "static const %s arg%d = %a;  // %.17g\n", real_type, i, constant_arguments[i], constant_arguments[i]);
+        } else {
+            fprintf(output_file, "%s arg%d = 0.0;\n", real_type, i);
+        }
     }
     fprintf(output_file, "\n");
 }
 
 /**
  * Generates function prototypes and the corresponding function body for each defined function.
- * @param output_file - The file pointer to write the generated C code.
+ * @param c_file - The file pointer to write the generated C code.
  */
-void generate_function_prototypes_and_code(FILE *output_file) {
+void generate_function_prototypes_and_code(FILE *c_file) {
     for (int i = 0; i < function_count; i++) {
         Function *func = &functions[i];
         debug_log("CODE", "Generating prototype and code for function: %s\n", func->name);
         update_function_prototype(func->name);
 
+        // When compiling in several units, the code is also kept for the function's unit
+        FILE *output_file = c_file;
+        size_t code_size;
+        free(func->generated_code);
+        func->generated_code = NULL;
+        if (compile_units > 1) {
+            output_file = open_memstream(&func->generated_code, &code_size);
+        }
+
         // Generate function prototype
-        fprintf(output_file, "%s %s(", func->return_type, func->name);
+        fprintf(output_file, "%s %s(", c_type(func->return_type), func->name);
         for (int j = 0; j < func->parameter_count; j++) {
-            fprintf(output_file, "%s %s", func->parameter_types[j], func->parameters[j]);
+            fprintf(output_file, "%s %s", c_type(func->parameter_types[j]), func->parameters[j]);
             if (j < func->parameter_count - 1) {
                 fprintf(output_file, ", ");
             }
         }
         fprintf(output_file, ");\n");
+        write_specialization_declarations(output_file, func);
+        if (output_file != c_file) {
+            func->declaration_size = ftell(output_file);
+        }
+
+        // Outlined parallel repeat blocks name the parameter types through typedefs
+        if (func->parallel_code && func->parallel_code[0]) {
+            for (int j = 0; j < func->parameter_count; j++) {
+                fprintf(output_file, "typedef %s ml_%s_p%d_t;\n", c_type(func->parameter_types[j]), func->name, j);
+            }
+            fputs(func->parallel_code, output_file);
+        }
+        free(func->parallel_code);
+        func->parallel_code = NULL;
 
         // Generate function code
-        fprintf(output_file, "%s %s(", func->return_type, func->name);
+        fprintf(output_file, "%s %s(", c_type(func->return_type), func->name);
         for (int j = 0; j < func->parameter_count; j++) {
-            fprintf(output_file, "%s %s", func->parameter_types[j], func->parameters[j]);
+            fprintf(output_file, "%s %s", c_type(func->parameter_types[j]), func->parameters[j]);
             if (j < func->parameter_count - 1) {
                 fprintf(output_file, ", ");
             }
@@ -478,6 +2636,12 @@ void generate_function_prototypes_and_code(FILE *output_file) {
         }
 
         fprintf(output_file, "}\n\n");
+        write_specialization_definitions(output_file, func);
+
+        if (output_file != c_file) {
+            fclose(output_file);
+            fputs(func->generated_code, c_file);
+        }
     }
 }
 
@@ -488,18 +2652,24 @@ void generate_function_prototypes_and_code(FILE *output_file) {
  */
 void generate_main_code(FILE *ml_file, FILE *output_file) {
     char line[MAX_LINE_LENGTH];
+    int line_number = 0;
     local_var_count = 0;  // Reset local variables count for the main function
     while (fgets(line, sizeof(line), ml_file)) {
+        line_number++;
         line[strcspn(line, "\n")] = '\0'; // Remove newline character
+        current_ml_line = line_number;
 
         // Skip function definitions (they've already been processed)
         if (strncmp(line, "function", 8) == 0) {
-            // Skip the function body lines
-            while (fgets(line, sizeof(line), ml_file)) {
-                if (line[0] != '\t') {
-                    break;
-                }
+            // Skip the function body lines and a blank line ending them, leaving the first
+            // statement after them unread, as store_function_definition_and_body() does
+            long position = ftell(ml_file);
+            while (fgets(line, sizeof(line), ml_file) && (line[0] == '\t' || line[0] == '\n')) {
+                position = ftell(ml_file);
+                line_number++;
+                if (line[0] == '\n') break;
             }
+            fseek(ml_file, position, SEEK_SET);
             continue;
         }
 
@@ -508,12 +2678,33 @@ void generate_main_code(FILE *ml_file, FILE *output_file) {
             continue; // Skip comments
         }
 
+        if (strncmp(line, "parallel repeat ", 16) == 0) {
+            // Collect the tab-indented block body, leaving the first line after it unread
+            char *body = NULL;
+            size_t body_size;
+            FILE *body_file = open_memstream(&body, &body_size);
+            char body_line[MAX_LINE_LENGTH];
+            long position = ftell(ml_file);
+            while (fgets(body_line, sizeof(body_line), ml_file) && body_line[0] == '\t') {
+                body_line[strcspn(body_line, "\n")] = '\0';
+                fprintf(body_file, "%s\n", body_line + 1);
+                position = ftell(ml_file);
+                line_number++;
+            }
+            fseek(ml_file, position, SEEK_SET);
+            fclose(body_file);
+            CHECKED_STEP(generate_parallel_repeat(line, body, output_file));
+            free(body);
+            continue;
+        }
+
         if (strstr(line, "<-")) {
-            store_variable(line, 0);  // Store as a local variable
+            CHECKED_STEP(store_variable(line, 0));  // Store as a local variable
         }
 
-        generate_c_code(line, output_file);
+        CHECKED_STEP(generate_c_code(line, output_file));
     }
+    current_ml_line = 0;
 }
 
 /**
@@ -523,15 +2714,46 @@ void generate_main_code(FILE *ml_file, FILE *output_file) {
  * @param output_file - The file pointer to write the translated C code.
  */
 void generate_c_code(const char *ml_code, FILE *output_file) {
+    MappedCode mapped;
+    if (begin_mapped_code(&mapped)) {
+        generate_c_code(ml_code, mapped.file);
+        end_mapped_code(&mapped, output_file);
+        return;
+    }
+    char matrix_name[MAX_IDENTIFIER_LENGTH + 1];
+    char indices[MAX_LINE_LENGTH];
+    char value[MAX_LINE_LENGTH];
+    if (line_counts && current_ml_line > 0 && !translating_parallel_body) {
+        generate_line_counter(output_file, current_ml_line, "1");
+    }
+    if (sscanf(ml_code, " %12[a-z0-9] [ %255[^]] ] <- %255[^\n]", matrix_name, indices, value) == 3) {
+        // Matrix element assignment: a[i, j] <- expression
+        debug_log("CODE", "Element assignment - Matrix: %s, Indices: %s, Expression: %s\n", matrix_name, indices, value);
+        if (check_mode) {
+            char element[MAX_LINE_LENGTH + MAX_IDENTIFIER_LENGTH + 4];
+            snprintf(element, sizeof(element), "%s[%s]", matrix_name, indices);
+            check_expression(element);
+            check_expression(value);
+        }
+        fprintf(output_file, "*ml_at(%s, ", matrix_name);
+        parse_expression(indices, output_file);
+        fprintf(output_file, ") = ");
+        parse_expression(value, output_file);
+        fprintf(output_file, ";\n");
+        return;
+    }
+
     if (strstr(ml_code, "<-")) {
         char identifier[MAX_IDENTIFIER_LENGTH];
         char expression[MAX_LINE_LENGTH];
         if (sscanf(ml_code, "%11s <- %[^\n]", identifier, expression) == 2) {
             debug_log("CODE", "Assignment - Identifier: %s, Expression: %s\n", identifier, expression);
+            check_expression(expression);
 
             // Determine if the variable is global or local
             char *type = NULL;
-            for (int i = 0; i < global_var_count; i++) {
+            int globals = visible_global_count < 0 ? global_var_count : visible_global_count;
+            for (int i = 0; i < globals; i++) {
                 if (strcmp(global_variables[i].name, identifier) == 0) {
                     type = global_variables[i].type;
                     break;
@@ -550,8 +2772,12 @@ void generate_c_code(const char *ml_code, FILE *output_file) {
                 strcpy(local_variables[local_var_count].name, identifier);
                 strcpy(local_variables[local_var_count].type, type);
                 local_var_count++;
-                fprintf(output_file, "%s %s = ", type, identifier);  // Local variable declaration
+                fprintf(output_file, "%s %s = ", c_type(type), identifier);  // Local variable declaration
             } else {
+                if ((strcmp(type, "ml_mat") == 0) != (strcmp(determine_variable_type(expression), "ml_mat") == 0)) {
+                    error_log("SYNTAX", "Cannot assign a %s to %s, which is a %s: %s\n", strcmp(type, "ml_mat") == 0 ? "number" : "matrix", identifier, strcmp(type, "ml_mat") == 0 ? "matrix" : "number", ml_code);
+                    return;
+                }
                 fprintf(output_file, "%s = ", identifier);  // Assignment to existing variable
             }
 
@@ -568,6 +2794,7 @@ void generate_c_code(const char *ml_code, FILE *output_file) {
         char expression[MAX_LINE_LENGTH];
         sscanf(ml_code + 6, "%[^\n]", expression);  // Get everything after 'print '
         debug_log("CODE", "Print - Expression: %s\n", expression);
+        check_expression(expression);
         generate_print_statement(output_file, expression);
         return;
     }
@@ -576,6 +2803,7 @@ void generate_c_code(const char *ml_code, FILE *output_file) {
         char expression[MAX_LINE_LENGTH];
         sscanf(ml_code + 7, "%[^\n]", expression);  // Get everything after 'return '
         debug_log("CODE", "Return - Expression: %s\n", expression);
+        check_expression(expression);
         // Translate return statement to C code
         fprintf(output_file, "return ");
         parse_expression(expression, output_file);
@@ -583,16 +2811,470 @@ void generate_c_code(const char *ml_code, FILE *output_file) {
         return;
     }
 
-    if (strchr(ml_code, '(') && strchr(ml_code, ')')) {
-        debug_log("CODE", "Function Call - %s\n", ml_code);
-        determine_parameter_types(ml_code);  // Determine parameter types for the function call
-        fprintf(output_file, "%s;\n", ml_code); // Translate directly to C function call
+    if (strncmp(ml_code, "bench ", 6) == 0) {
+        debug_log("CODE", "Bench - %s\n", ml_code + 6);
+        generate_bench_statement(output_file, ml_code + 6);
+        return;
+    }
+
+    if (strchr(ml_code, '(') && strchr(ml_code, ')')) {
+        debug_log("CODE", "Function Call - %s\n", ml_code);
+        check_expression(ml_code);
+        record_function_call(ml_code);
+        char specialized[MAX_LINE_LENGTH];
+        fprintf(output_file, "%s;\n", specialize_constant_calls(ml_code, specialized, sizeof(specialized), 0) ? specialized : ml_code); // Translate directly to C function call
         return;
     }
 
     error_log("SYNTAX", "Unrecognized statement: %s\n", ml_code);
 }
 
+/**
+ * Translates one line of a parallel repeat body: a reduction into an accumulator or an ordinary statement.
+ * @param line - The body line, with the extra tab removed.
+ * @param names - The variables copied into the block; the first accumulator_count are accumulators.
+ * @param types - The C types of the variables.
+ * @param operations - The reduction of each accumulator: "sum", "min" or "max".
+ * @param accumulator_count - The number of accumulators.
+ * @param loop_file - The file pointer to write the loop body to.
+ */
+void translate_parallel_body_line(const char *line, char names[][MAX_IDENTIFIER_LENGTH + 1], char types[][MAX_IDENTIFIER_LENGTH + 32], char operations[][4], int accumulator_count, FILE *loop_file) {
+    MappedCode mapped;
+    if (begin_mapped_code(&mapped)) {
+        translate_parallel_body_line(line, names, types, operations, accumulator_count, mapped.file);
+        end_mapped_code(&mapped, loop_file);
+        return;
+    }
+    char identifier[MAX_IDENTIFIER_LENGTH];
+    char expression[MAX_LINE_LENGTH];
+    int accumulator = -1;
+    if (sscanf(line, "%11s <- %[^\n]", identifier, expression) == 2) {
+        for (int i = 0; i < accumulator_count; i++) {
+            if (strcmp(names[i], identifier) == 0) accumulator = i;
+        }
+    }
+
+    if (line[0] == '\t' || line[0] == '\0') {
+        error_log("SYNTAX", "Invalid indentation in parallel repeat: %s\n", line);
+    } else if (strncmp(line, "parallel repeat ", 16) == 0) {
+        error_log("SYNTAX", "Nested parallel repeat blocks are not supported: %s\n", line);
+    } else if (strncmp(line, "return", 6) == 0) {
+        error_log("SYNTAX", "Return inside a parallel repeat: %s\n", line);
+    } else if (accumulator >= 0 && strcmp(operations[accumulator], "sum") == 0) {
+        debug_log("CODE", "Reduction - sum %s: %s\n", identifier, expression);
+        check_expression(expression);
+        fprintf(loop_file, "%s = %s + (", identifier, identifier);
+        parse_expression(expression, loop_file);
+        fprintf(loop_file, ");\n");
+    } else if (accumulator >= 0) {
+        debug_log("CODE", "Reduction - %s %s: %s\n", operations[accumulator], identifier, expression);
+        check_expression(expression);
+        fprintf(loop_file, "{\n%s ml_value = ", types[accumulator]);
+        parse_expression(expression, loop_file);
+        fprintf(loop_file, ";\nif (ml_value %c %s) %s = ml_value;\n}\n", strcmp(operations[accumulator], "min") == 0 ? '<' : '>', identifier, identifier);
+    } else {
+        generate_c_code(line, loop_file);
+    }
+}
+
+/**
+ * Generates a parallel repeat block: "parallel repeat <count> <index> [sum|min|max <name>]..."
+ * followed by lines indented by one more tab. The iterations must be independent: the body is
+ * outlined into a function over an index range, which ml_parallel_for() splits over threads.
+ * Locals and parameters of the enclosing scope are copied in, and variables assigned in the body
+ * are private to it; a global assigned there is copied in as well, so the global itself is left
+ * unchanged. Assigning to a declared accumulator contributes to it instead: each thread
+ * keeps a partial that is merged into the accumulator when its range is done.
+ * @param header - The parallel repeat line.
+ * @param body - The body lines, each ending in a newline, with the extra tab removed.
+ * @param output_file - The file pointer to write the call site to.
+ */
+void generate_parallel_repeat(const char *header, char *body, FILE *output_file) {
+    MappedCode mapped;
+    if (begin_mapped_code(&mapped)) {
+        generate_parallel_repeat(header, body, mapped.file);  // The call site; the body lines are mapped on their own
+        end_mapped_code(&mapped, output_file);
+        return;
+    }
+    char count[MAX_LINE_LENGTH];
+    char index_name[MAX_LINE_LENGTH];
+    char reductions[MAX_LINE_LENGTH] = "";
+    if (sscanf(header, "parallel repeat %255s %255s %255[^\n]", count, index_name, reductions) < 2 || !is_valid_identifier(index_name)) {
+        error_log("SYNTAX", "Invalid parallel repeat: %s\n", header);
+        return;
+    }
+    check_expression(count);
+
+    // Variables copied into the block: name, C type, and the type used to infer expressions
+    char names[MAX_IDENTIFIERS][MAX_IDENTIFIER_LENGTH + 1];
+    char types[MAX_IDENTIFIERS][MAX_IDENTIFIER_LENGTH + 32];
+    char scope_types[MAX_IDENTIFIERS][10];
+    char operations[MAX_IDENTIFIERS][4];  // "sum", "min", "max", or "" for a plain copy
+    int variable_count = 0;
+
+    char *operation = strtok(reductions, " ");
+    while (operation) {
+        char *name = strtok(NULL, " ");
+        if (!name || (strcmp(operation, "sum") != 0 && strcmp(operation, "min") != 0 && strcmp(operation, "max") != 0) || !is_valid_identifier(name)) {
+            error_log("SYNTAX", "Invalid reduction in parallel repeat: %s\n", header);
+            return;
+        }
+        if (variable_count >= MAX_IDENTIFIERS - 1) {
+            error_log("SYNTAX", "Too many variables defined.\n");
+            return;
+        }
+        strcpy(names[variable_count], name);
+        strcpy(operations[variable_count], operation);
+        variable_count++;
+        operation = strtok(NULL, " ");
+    }
+    int accumulator_count = variable_count;
+
+    // Then the locals of the enclosing scope that are not globals, and the function parameters
+    int globals = visible_global_count < 0 ? global_var_count : visible_global_count;
+    int parameter_count = translating_function ? translating_function->parameter_count : 0;
+    for (int i = 0; i < local_var_count + parameter_count; i++) {
+        const char *name = i < local_var_count ? local_variables[i].name : translating_function->parameters[i - local_var_count];
+        int skip = strcmp(name, index_name) == 0;
+        for (int j = 0; j < globals && !skip; j++) {
+            skip = strcmp(global_variables[j].name, name) == 0;
+        }
+        for (int j = 0; j < variable_count && !skip; j++) {
+            skip = strcmp(names[j], name) == 0;
+        }
+        if (skip) continue;
+        if (variable_count >= MAX_IDENTIFIERS - 1) {
+            error_log("SYNTAX", "Too many variables defined.\n");
+            return;
+        }
+        strcpy(names[variable_count], name);
+        operations[variable_count][0] = '\0';
+        variable_count++;
+    }
+
+    // Globals assigned in the body are copied in too, so each iteration writes a private copy
+    // instead of every thread racing on the shared variable
+    for (const char *statement = body; statement && *statement; statement = strchr(statement, '\n') + 1) {
+        statement += strspn(statement, " \t");
+        size_t length = 0;
+        while (isalnum((unsigned char)statement[length]) || statement[length] == '_') length++;
+        const char *arrow = statement + length + strspn(statement + length, " ");
+        if (length == 0 || length > MAX_IDENTIFIER_LENGTH || strncmp(arrow, "<-", 2) != 0) continue;
+        char name[MAX_IDENTIFIER_LENGTH + 1];
+        snprintf(name, sizeof(name), "%.*s", (int)length, statement);
+        int global = 0;
+        for (int j = 0; j < globals && !global; j++) {
+            global = strcmp(global_variables[j].name, name) == 0;
+        }
+        for (int j = 0; j < variable_count && global; j++) {
+            global = strcmp(names[j], name) != 0;
+        }
+        if (!global || strcmp(name, index_name) == 0) continue;
+        if (variable_count >= MAX_IDENTIFIERS - 1) {
+            error_log("SYNTAX", "Too many variables defined.\n");
+            return;
+        }
+        strcpy(names[variable_count], name);
+        operations[variable_count][0] = '\0';
+        variable_count++;
+    }
+
+    // Resolve each variable's type: locals, then visible globals, then parameters through their typedef
+    for (int i = 0; i < variable_count; i++) {
+        types[i][0] = '\0';
+        for (int j = 0; j < local_var_count && !types[i][0]; j++) {
+            if (strcmp(local_variables[j].name, names[i]) == 0) strcpy(types[i], c_type(local_variables[j].type));
+        }
+        for (int j = 0; j < globals && !types[i][0]; j++) {
+            if (strcmp(global_variables[j].name, names[i]) == 0) strcpy(types[i], c_type(global_variables[j].type));
+        }
+        for (int j = 0; j < parameter_count && !types[i][0]; j++) {
+            if (strcmp(translating_function->parameters[j], names[i]) == 0) {
+                snprintf(types[i], sizeof(types[i]), "ml_%s_p%d_t", translating_function->name, j);
+            }
+        }
+        if (!types[i][0]) {
+            error_log("SYNTAX", "Accumulator %s must be assigned before the parallel repeat\n", names[i]);
+            return;
+        }
+        strcpy(scope_types[i], strcmp(types[i], "int64_t") == 0 ? "int64_t" : "double");
+    }
+
+    // Translate the body in a scope of its own: the copied variables and the index
+    Variable saved_variables[MAX_IDENTIFIERS];
+    int saved_count = local_var_count;
+    memcpy(saved_variables, local_variables, sizeof(saved_variables));
+    for (int i = 0; i < variable_count; i++) {
+        strcpy(local_variables[i].name, names[i]);
+        strcpy(local_variables[i].type, scope_types[i]);
+    }
+    strcpy(local_variables[variable_count].name, index_name);
+    strcpy(local_variables[variable_count].type, "int64_t");
+    local_var_count = variable_count + 1;
+
+    // Every body line runs once per iteration, so their counters are bumped by the count at the call site
+    int header_line = current_ml_line;
+    int body_line_count = 0;
+    for (const char *c = body; c && *c; c++) {
+        body_line_count += *c == '\n';
+    }
+
+    char *loop_body = NULL;
+    size_t loop_body_size;
+    FILE *loop_file = open_memstream(&loop_body, &loop_body_size);
+    if (!loop_file) {
+        error_log("FILE", "Out of memory translating a parallel repeat\n");
+        exit(EXIT_FAILURE);
+    }
+    char *line = body;
+    translating_parallel_body = 1;
+    for (int body_line = 1; line && *line; body_line++) {
+        char *end = strchr(line, '\n');
+        *end = '\0';
+        current_ml_line = header_line > 0 ? header_line + body_line : 0;
+        CHECKED_STEP(translate_parallel_body_line(line, names, types, operations, accumulator_count, loop_file));
+        line = end + 1;
+    }
+    translating_parallel_body = 0;
+    fclose(loop_file);
+    current_ml_line = header_line;
+
+    memcpy(local_variables, saved_variables, sizeof(saved_variables));
+    local_var_count = saved_count;
+
+    // The outlined function, written ahead of the enclosing function
+    char block_name[MAX_IDENTIFIER_LENGTH + 32];
+    snprintf(block_name, sizeof(block_name), "ml_par_%s_%d", translating_function ? translating_function->name : "main", parallel_block_count++);
+    FILE *code = parallel_code_file;
+    fprintf(code, "struct %s_context {\nint64_t count;\n", block_name);
+    if (program_uses_random) {
+        fprintf(code, "uint64_t random_key;\n");
+    }
+    for (int i = 0; i < variable_count; i++) {
+        fprintf(code, "%s %s;\n", types[i], names[i]);
+    }
+    for (int i = 0; i < accumulator_count; i++) {
+        fprintf(code, "%s %s_partials[ML_PARALLEL_CHUNKS];\n", types[i], names[i]);
+    }
+    fprintf(code, "};\n");
+    fprintf(code, "%svoid %s(void *context, int64_t chunk, int64_t begin, int64_t end) {\n", multiversion ? "ML_MULTIVERSION " : "", block_name);
+    fprintf(code, "struct %s_context *ml_context = context;\n(void)ml_context;\n", block_name);
+    for (int i = 0; i < variable_count; i++) {
+        if (strcmp(operations[i], "sum") == 0) {
+            fprintf(code, "%s %s = 0;\n", types[i], names[i]);  // Partial sums start from zero
+        } else {
+            fprintf(code, "%s %s = ml_context->%s;\n(void)%s;\n", types[i], names[i], names[i], names[i]);
+        }
+    }
+    // The loop is where vectorization is reported, so --opt-report ties it to the header line
+    char loop_line[sizeof(mapped_source_name) + 32] = "";
+    if (opt_report && header_line > 0) {
+        snprintf(loop_line, sizeof(loop_line), "#line %d \"%s\"\n", header_line, mapped_source_name);
+    }
+    if (program_uses_random) {
+        // Each iteration draws from its own stream, whichever thread runs it
+        fprintf(code, "ml_random_state ml_saved_random = ml_random_swap(ml_random_substream(ml_context->random_key, begin));\n");
+        fprintf(code, "%sfor (int64_t %s = begin; %s < end; %s++) {\n", loop_line, index_name, index_name, index_name);
+        fprintf(code, "%sml_random_swap(ml_random_substream(ml_context->random_key, %s));\n%s}\n", loop_line, index_name, loop_body);
+        fprintf(code, "ml_random_swap(ml_saved_random);\n");
+    } else {
+        fprintf(code, "%sfor (int64_t %s = begin; %s < end; %s++) {\n%s}\n", loop_line, index_name, index_name, index_name, loop_body);
+    }
+    if (accumulator_count == 0) {
+        fprintf(code, "(void)chunk;\n");
+    }
+    for (int i = 0; i < accumulator_count; i++) {
+        fprintf(code, "ml_context->%s_partials[chunk] = %s;\n", names[i], names[i]);
+    }
+    fprintf(code, "}\n\n");
+    free(loop_body);
+
+    // The call site copies the variables in and the accumulators back out
+    if (line_counts && header_line > 0 && !translating_parallel_body) {
+        generate_line_counter(output_file, header_line, "1");
+    }
+    fprintf(output_file, "{\nstruct %s_context ml_context = { .count = (int64_t)(", block_name);
+    parse_expression(count, output_file);
+    fprintf(output_file, ")");
+    if (program_uses_random) {
+        fprintf(output_file, ", .random_key = ml_random_fork()");
+    }
+    for (int i = 0; i < variable_count; i++) {
+        fprintf(output_file, ", .%s = %s", names[i], names[i]);
+    }
+    fprintf(output_file, " };\n");
+    fprintf(output_file, "ml_parallel_for(ml_context.count, %s, &ml_context);\n", block_name);
+    for (int i = 1; line_counts && header_line > 0 && i <= body_line_count; i++) {
+        generate_line_counter(output_file, header_line + i, "(ml_context.count > 0 ? ml_context.count : 0)");
+    }
+    if (accumulator_count > 0) {
+        // Partials merge in chunk order, so the result does not depend on thread timing
+        fprintf(output_file, "for (int64_t ml_chunk = 0; ml_chunk < ml_parallel_chunks(ml_context.count); ml_chunk++) {\n");
+        for (int i = 0; i < accumulator_count; i++) {
+            if (strcmp(operations[i], "sum") == 0) {
+                fprintf(output_file, "%s = %s + ml_context.%s_partials[ml_chunk];\n", names[i], names[i], names[i]);
+            } else {
+                fprintf(output_file, "if (ml_context.%s_partials[ml_chunk] %c %s) %s = ml_context.%s_partials[ml_chunk];\n", names[i], strcmp(operations[i], "min") == 0 ? '<' : '>', names[i], names[i], names[i]);
+            }
+        }
+        fprintf(output_file, "}\n");
+    }
+    fprintf(output_file, "}\n");
+}
+
+/**
+ * Records a call statement so the callee's parameter types follow its arguments.
+ * @param ml_code - The call, e.g. "f(1, x)".
+ */
+void record_function_call(const char *ml_code) {
+    if (translating_function) {
+        // Inside a body: resolved after all bodies are translated (see translate_function_bodies)
+        size_t length = translating_function->deferred_calls ? strlen(translating_function->deferred_calls) : 0;
+        char *calls = realloc(translating_function->deferred_calls, length + strlen(ml_code) + 2);
+        if (calls) {
+            sprintf(calls + length, "%s\n", ml_code);
+            translating_function->deferred_calls = calls;
+        }
+    } else {
+        determine_parameter_types(ml_code, function_count);  // Determine parameter types for the function call
+    }
+}
+
+/**
+ * Generates the counter increment for one ml line and marks the line as counted.
+ * Functions can run on several threads inside parallel repeat blocks, so those programs
+ * count with relaxed atomic adds.
+ * @param output_file - The file pointer to write the generated C code.
+ * @param line_number - The ml line.
+ * @param amount - C expression to add.
+ */
+void generate_line_counter(FILE *output_file, int line_number, const char *amount) {
+    if (line_number > source_line_count) {
+        return;
+    }
+    counted_lines[line_number] = 1;
+    if (program_uses_parallel) {
+        fprintf(output_file, "atomic_fetch_add_explicit(&ml_line_hits[%d], %s, memory_order_relaxed);\n", line_number, amount);
+    } else if (strcmp(amount, "1") == 0) {
+        fprintf(output_file, "ml_line_hits[%d]++;\n", line_number);
+    } else {
+        fprintf(output_file, "ml_line_hits[%d] += %s;\n", line_number, amount);
+    }
+}
+
+/**
+ * For --opt-report: starts capturing the C generated for the current ml line, unless it is being
+ * captured already, so end_mapped_code() can give each line of it a #line directive.
+ * @param mapped - Receives the capture.
+ * @return The capture file to generate into, or NULL when the code is written directly.
+ */
+FILE *begin_mapped_code(MappedCode *mapped) {
+    if (!opt_report || current_ml_line <= 0 || mapped_ml_line == current_ml_line) {
+        return NULL;
+    }
+    mapped->code = NULL;
+    mapped->file = open_memstream(&mapped->code, &mapped->size);
+    if (!mapped->file) {
+        return NULL;  // Unmapped code is still correct, its remarks just count as generated
+    }
+    mapped->line = current_ml_line;
+    mapped->saved_line = mapped_ml_line;
+    mapped_ml_line = current_ml_line;
+    return mapped->file;
+}
+
+/**
+ * Writes captured C with each line tied to its ml line, then moves the position to "<generated>"
+ * so the code that follows is not attributed to the line.
+ * @param mapped - The capture started by begin_mapped_code().
+ * @param output_file - The file pointer to write the code to.
+ */
+void end_mapped_code(MappedCode *mapped, FILE *output_file) {
+    fclose(mapped->file);
+    mapped_ml_line = mapped->saved_line;
+    for (const char *line = mapped->code; *line; ) {
+        size_t length = strcspn(line, "\n");
+        if (*line != '#') {
+            fprintf(output_file, "#line %d \"%s\"\n", mapped->line, mapped_source_name);
+        }
+        fprintf(output_file, "%.*s\n", (int)length, line);
+        line += length + (line[length] == '\n');
+    }
+    fprintf(output_file, "#line 1 \"<generated>\"\n");
+    free(mapped->code);
+}
+
+/**
+ * Generates a bench statement, "bench <call> <count>": the call is run count / 10 times to warm up,
+ * then in batches that are doubled until one takes BENCH_MIN_BATCH_SECONDS, and finally timed over
+ * up to BENCH_MAX_SAMPLES batches within count calls. Results go to a volatile sink so the compiler
+ * cannot drop the call, and the ns/call distribution over the batches is printed.
+ * @param output_file - The file pointer to write the generated C code.
+ * @param statement - The statement after "bench ".
+ */
+void generate_bench_statement(FILE *output_file, const char *statement) {
+    char call[MAX_LINE_LENGTH];
+    snprintf(call, sizeof(call), "%s", statement);
+    char *count = strrchr(call, ' ');
+    if (!count || !strchr(call, '(') || strpbrk(call, "\"\\")) {
+        error_log("SYNTAX", "Expected bench <call> <count>: bench %s\n", statement);
+    }
+    *count++ = '\0';
+    if (trial_count > 0) {
+        error_log("SYNTAX", "bench cannot be used with --trials: bench %s\n", statement);
+    }
+    check_expression(call);
+    check_expression(count);
+
+    char name[MAX_LINE_LENGTH];
+    const char *sink = "ml_bench_sink = ";
+    if (sscanf(call, " %255[a-z0-9] (", name) == 1) {
+        for (int i = 0; i < function_count; i++) {
+            if (strcmp(functions[i].name, name) == 0 && !functions[i].returns_matrix && strcmp(functions[i].return_type, "void") == 0) {
+                sink = "";  // Nothing to keep; the call is not pure, so it stays
+            }
+        }
+        if (*sink && builtin_return_type(name) == NULL) {
+            record_function_call(call);
+        }
+    }
+    if (*sink && strcmp(determine_variable_type(call), "ml_mat") == 0) {
+        sink = "ml_bench_pointer_sink = ";
+    }
+
+    char timed_call[MAX_LINE_LENGTH * 2];
+    FILE *call_file = fmemopen(timed_call, sizeof(timed_call), "w");
+    if (!call_file) {
+        error_log("FILE", "Out of memory generating bench %s\n", statement);
+        exit(EXIT_FAILURE);
+    }
+    fprintf(call_file, "%s", sink);
+    emitting_bench_call = 1;
+    parse_expression(call, call_file);
+    emitting_bench_call = 0;
+    fputc('\0', call_file);
+    fclose(call_file);
+
+    fprintf(output_file, "{\nint64_t ml_bench_calls = (int64_t)(");
+    parse_expression(count, output_file);
+    fprintf(output_file, ");\n");
+    fprintf(output_file, "if (ml_bench_calls < 1) ml_bench_calls = 1;\n");
+    fprintf(output_file, "for (int64_t ml_i = 0; ml_i <= ml_bench_calls / 10; ml_i++) {\n%s;\n}\n", timed_call);
+    fprintf(output_file, "int64_t ml_bench_batch = 1;\n");
+    fprintf(output_file, "for (;;) {\n");
+    fprintf(output_file, "double ml_start = ml_clock();\n");
+    fprintf(output_file, "for (int64_t ml_i = 0; ml_i < ml_bench_batch; ml_i++) {\n%s;\n}\n", timed_call);
+    fprintf(output_file, "if (ml_clock() - ml_start >= %g || ml_bench_batch >= ml_bench_calls) break;\n", BENCH_MIN_BATCH_SECONDS);
+    fprintf(output_file, "ml_bench_batch = ml_bench_batch * 2 < ml_bench_calls ? ml_bench_batch * 2 : ml_bench_calls;\n}\n");
+    fprintf(output_file, "int64_t ml_bench_count = ml_bench_sample_count(ml_bench_calls, ml_bench_batch);\n");
+    fprintf(output_file, "double ml_bench_samples[%d];\n", BENCH_MAX_SAMPLES);
+    fprintf(output_file, "for (int64_t ml_sample = 0; ml_sample < ml_bench_count; ml_sample++) {\n");
+    fprintf(output_file, "double ml_start = ml_clock();\n");
+    fprintf(output_file, "for (int64_t ml_i = 0; ml_i < ml_bench_batch; ml_i++) {\n%s;\n}\n", timed_call);
+    fprintf(output_file, "ml_bench_samples[ml_sample] = (ml_clock() - ml_start) * 1e9 / ml_bench_batch;\n}\n");
+    fprintf(output_file, "ml_bench_report(\"%s\", ml_bench_samples, ml_bench_count, ml_bench_batch);\n}\n", call);
+}
+
 /**
  * Parses an ml expression and generates its C equivalent.
  * Ensures that the expression is syntactically valid.
@@ -615,7 +3297,7 @@ void parse_expression(const char *expr, FILE *output_file) {
         }
 
         // Check for invalid characters
-        if (!isalnum(*expr) && !strchr("+-*/()., ", *expr)) {
+        if (!isalnum(*expr) && !strchr("+-*/()[]., ", *expr)) {
             error_log("SYNTAX", "Invalid character in expression: %c\n", *expr);
             return;
         }
@@ -628,8 +3310,16 @@ void parse_expression(const char *expr, FILE *output_file) {
         return;
     }
 
+    check_cancellation(term);
+
     // Proceed with parsing the expression...
-    parse_term_or_factor(term, output_file);
+    char specialized[MAX_LINE_LENGTH];
+    if (specialize_constant_calls(term, specialized, sizeof(specialized), 1)) {
+        term = specialized;
+    }
+    char rewritten[MAX_LINE_LENGTH * 2];
+    rewrite_builtin_calls(term, rewritten, sizeof(rewritten));
+    parse_term_or_factor(rewritten, output_file);
 }
 
 /**
@@ -670,8 +3360,9 @@ void parse_term_or_factor(const char *expr, FILE *output_file) {
  * Determines the types of parameters in a function call by parsing the provided arguments.
  * Updates the function prototype to reflect the correct parameter types.
  * @param function_call - The string containing the function call with parameters.
+ * @param visible_functions - Only the first visible_functions functions can be called.
  */
-void determine_parameter_types(const char *function_call) {
+void determine_parameter_types(const char *function_call, int visible_functions) {
     char function_name[MAX_IDENTIFIER_LENGTH + 1];
     char parameter_values[MAX_LINE_LENGTH];
     char *token;
@@ -679,7 +3370,7 @@ void determine_parameter_types(const char *function_call) {
 
     sscanf(function_call, "%12s(%[^\n])", function_name, parameter_values);
 
-    for (int i = 0; i < function_count; i++) {
+    for (int i = 0; i < visible_functions; i++) {
         if (strcmp(functions[i].name, function_name) == 0) {
             // Determine the parameter types from the values passed in the function call
             token = strtok(parameter_values, ", ");
@@ -695,6 +3386,7 @@ void determine_parameter_types(const char *function_call) {
             if (functions[i].parameter_count > 0) {
                 strcpy(functions[i].return_type, functions[i].parameter_types[0]);
             }
+            settle_matrix_return_type(&functions[i]);
 
             break;
         }
@@ -717,6 +3409,14 @@ void update_function_prototype(const char *function_name) {
                 }
                 strcpy(functions[i].return_type, "double");
             }
+            // Parameters found to be matrices from the body leave the others to default on their own
+            for (int j = 0; j < functions[i].parameter_count; j++) {
+                if (strcmp(functions[i].parameter_types[j], "unknown") == 0) strcpy(functions[i].parameter_types[j], "double");
+            }
+            if (strcmp(functions[i].return_type, "void") == 0 && functions[i].has_return_statement) {
+                strcpy(functions[i].return_type, "double");
+            }
+            settle_matrix_return_type(&functions[i]);
             break;
         }
     }
@@ -729,15 +3429,45 @@ void update_function_prototype(const char *function_name) {
  * @param expression - The expression to be printed.
  */
 void generate_print_statement(FILE *output_file, const char *expression) {
+    if (trial_count > 0) {
+        // Printed values are collected for runml to aggregate over the trials
+        if (strcmp(determine_variable_type(expression), "ml_mat") == 0) {
+            error_log("SYNTAX", "Matrices cannot be printed with --trials: %s\n", expression);
+        }
+        fprintf(output_file, "ml_trial_print((double)(");
+        parse_expression(expression, output_file);
+        fprintf(output_file, "));\n");
+        return;
+    }
+
+    if (strcmp(determine_variable_type(expression), "ml_mat") == 0) {
+        fprintf(output_file, "ml_print_matrix(");
+        parse_expression(expression, output_file);
+        fprintf(output_file, ");\n");
+        return;
+    }
+
+    if (strcmp(determine_variable_type(expression), "int64_t") == 0) {
+        // Integer expressions are printed exactly, without a round trip through double
+        fprintf(output_file, "printf(\"%%\" PRId64 \"\\n\", (int64_t)(");
+        parse_expression(expression, output_file);
+        fprintf(output_file, "));\n");
+        return;
+    }
+
     fprintf(output_file, "{\n");
-    fprintf(output_file, "double temp_value;\n");
+    fprintf(output_file, "%s temp_value;\n", real_type);
     fprintf(output_file, "temp_value = ");
     parse_expression(expression, output_file);
     fprintf(output_file, ";\n");
+    if (print_all_digits) {
+        fprintf(output_file, "printf(\"%%.17g\\n\", (double)temp_value);\n}\n");
+        return;
+    }
 
     // Check if temp_value is an integer or not
-    fprintf(output_file, "if (fabs(temp_value - (int)temp_value) < 1e-6) {\n");
-    fprintf(output_file, "printf(\"%%d\\n\", (int)temp_value);\n");
+    fprintf(output_file, "if (fabs(temp_value) < 9.2e18 && fabs(temp_value - (int64_t)temp_value) < 1e-6) {\n");
+    fprintf(output_file, "printf(\"%%\" PRId64 \"\\n\", (int64_t)temp_value);\n");
     fprintf(output_file, "} else {\n");
     fprintf(output_file, "printf(\"%%.6f\\n\", temp_value);\n");
     fprintf(output_file, "}\n");
@@ -746,119 +3476,2754 @@ void generate_print_statement(FILE *output_file, const char *expression) {
 }
 
 /**
- * Compiles the generated C file.
- * @param pid - The process ID, used for creating the unique filename.
- * @return - EXIT_SUCCESS on successful compilation, EXIT_FAILURE on error.
+ * Describes the instruction sets a compiled program is built for, which the binary cache key
+ * includes: the machine architecture, and with --multiversion the clone targets. Hosts of other
+ * architectures sharing a cache directory never get each other's binaries, while multi-versioned
+ * binaries, which run on any x86-64, are shared by all x86-64 hosts.
+ * @return The description, e.g. "x86_64" or "x86_64+avx512f,avx2,default".
  */
-int compile_c_program(pid_t pid) {
-    char compile_command[256];
-    snprintf(compile_command, sizeof(compile_command), "cc -std=c11 -Wall -Werror -o ml_%d ml_%d.c", pid, pid);
-    debug_log("INFO", "Compiling the C file with command: %s\n", compile_command);
-    if (system(compile_command) != 0) {
-        error_log("FILE", "Compilation failed for ml_%d.c\n", pid);
-        return EXIT_FAILURE;
+const char *target_isa(void) {
+    static char isa[128];
+    if (!isa[0]) {
+        struct utsname host;
+        size_t length = snprintf(isa, sizeof(isa), "%s%s", uname(&host) == 0 ? host.machine : "unknown", multiversion ? "+" : "");
+        for (const char *c = MULTIVERSION_TARGETS; multiversion && *c && length < sizeof(isa) - 1; c++) {
+            if (*c != '"' && *c != ' ') isa[length++] = *c;  // The target list without quotes
+        }
+        isa[length] = '\0';
     }
-    return EXIT_SUCCESS;
+    return isa;
 }
 
 /**
- * Executes the compiled C program.
+ * Compiles the generated C file.
+ * In zygote mode the program is built as a shared object whose main() is renamed to ml_entry().
+ * With the binary cache enabled, an earlier build of the same generated C and flags is reused,
+ * and a fresh build is published to the cache with an atomic rename.
  * @param pid - The process ID, used for creating the unique filename.
- * @param argc - The argument count.
- * @param argv - The argument vector (command-line arguments).
- * @return - EXIT_SUCCESS on successful execution, EXIT_FAILURE on error.
+ * @return - EXIT_SUCCESS on successful compilation, EXIT_FAILURE on error.
  */
-int execute_c_program(pid_t pid, int argc, char *argv[]) {
-    char execute_command[256];
-    snprintf(execute_command, sizeof(execute_command), "./ml_%d", pid);
+int compile_c_program(pid_t pid) {
+    char compile_flags[256];
+    char link_flags[64];
+    const char *thread_flags = parallel_thread_flags();
+    // The matrix kernels are only vectorized, and constant arguments only propagated, when optimizing
+    const char *optimization = optimization_flags ? optimization_flags : program_uses_matrices || constant_arguments || opt_report || multiversion ? " -O2" : "";
+    snprintf(compile_flags, sizeof(compile_flags), "-std=c11 -Wall -Werror%s%s%s%s", zygote_mode ? " -fPIC -Dmain=ml_entry" : "",
+             optimization, thread_flags, opt_report ? optimization_remark_flags() : "");
+    snprintf(link_flags, sizeof(link_flags), "%s%s", zygote_mode ? "-shared" : "", thread_flags);
+    const char *directory = cache_binaries ? cache_directory() : NULL;
+    char output_filename[640];
 
-    // Append optional command-line arguments
-    for (int i = 2; i < argc; i++) {
-        strcat(execute_command, " ");
-        strcat(execute_command, argv[i]);
+    if (directory) {
+        if (!program_hash) {
+            program_hash = hash_c_program(pid);
+        }
+        uint64_t key = hash_bytes(program_hash, compile_flags, strlen(compile_flags));
+        key = hash_bytes(key, link_flags, strlen(link_flags));
+        key = hash_bytes(key, program_libraries(), strlen(program_libraries()));
+        key = hash_bytes(key, target_isa(), strlen(target_isa()));
+        snprintf(program_path, sizeof(program_path), "%s/%016" PRIx64 "%s", directory, key, zygote_mode ? ".so" : ".bin");
+        if (access(program_path, X_OK) == 0) {
+            debug_log("INFO", "Using cached binary %s\n", program_path);
+            return EXIT_SUCCESS;
+        }
+        snprintf(output_filename, sizeof(output_filename), "%s.%d.tmp", program_path, pid);
+    } else {
+        snprintf(program_path, sizeof(program_path), zygote_mode ? "./ml_%d.so" : "./ml_%d", pid);
+        snprintf(output_filename, sizeof(output_filename), "%s", program_path);
     }
 
-    debug_log("INFO", "Executing the compiled program with command: %s\n", execute_command);
-    if (system(execute_command) != 0) {
-        error_log("FILE", "Execution failed for ml_%d\n", pid);
+    if (compile_units > 1 || compile_report) {
+        if (compile_translation_units(pid, compile_flags, link_flags, output_filename) != EXIT_SUCCESS) {
+            if (directory) remove(output_filename);
+            return EXIT_FAILURE;
+        }
+    } else {
+        char compile_command[1536];
+        char remarks_redirect[64] = "";
+        if (opt_report) {
+            snprintf(remarks_redirect, sizeof(remarks_redirect), " 2> ml_%d.remarks", pid);  // Read by write_opt_report()
+        }
+        snprintf(compile_command, sizeof(compile_command), "cc %s %s -o '%s' ml_%d.c%s%s", compile_flags, link_flags, output_filename, pid,
+                 program_libraries(), remarks_redirect);
+        debug_log("INFO", "Compiling the C file with command: %s\n", compile_command);
+        if (system(compile_command) != 0) {
+            if (opt_report) {
+                snprintf(remarks_redirect, sizeof(remarks_redirect), "ml_%d.remarks", pid);
+                copy_file_to_stream(remarks_redirect, stderr);  // The compiler's errors are among the remarks
+                remove(remarks_redirect);
+            }
+            error_log("FILE", "Compilation failed for ml_%d.c\n", pid);
+            if (directory) remove(output_filename);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (directory && rename(output_filename, program_path) != 0) {
+        error_log("FILE", "Could not store %s in the cache\n", program_path);
+        remove(output_filename);
         return EXIT_FAILURE;
     }
     return EXIT_SUCCESS;
 }
 
 /**
- * Cleans up the temporary files (both the .c file and the compiled binary).
+ * Writes the program as compile_units translation units: a shared header ml_<pid>.h with the
+ * includes, extern globals and every prototype, and units ml_<pid>_<n>.c. Unit 0 defines the
+ * globals and main(); functions are spread over the units so each gets a similar amount of code.
  * @param pid - The process ID, used for creating the unique filenames.
+ * @return - EXIT_SUCCESS if every file was written, EXIT_FAILURE otherwise.
  */
-void clean_up(pid_t pid) {
-    debug_log("INFO", "Cleaning up temporary files\n");
-    char c_filename[64];
-    snprintf(c_filename, sizeof(c_filename), "ml_%d.c", pid);  // Format: ml_<PID>.c
-    remove(c_filename);  // Remove the C file
-    char binary_filename[64];
-    snprintf(binary_filename, sizeof(binary_filename), "ml_%d", pid);
-    remove(binary_filename);  // Remove the compiled program
+int write_translation_units(pid_t pid) {
+    char filename[64];
+    snprintf(filename, sizeof(filename), "ml_%d.h", pid);
+    FILE *header = fopen(filename, "w");
+    if (!header) {
+        error_log("FILE", "Could not create %s\n", filename);
+        return EXIT_FAILURE;
+    }
+    write_c_includes(header);
+    for (int i = 0; i < global_var_count; i++) {
+        fprintf(header, "extern %s %s;\n", c_type(global_variables[i].type), global_variables[i].name);
+    }
+    for (int i = 0; i <= max_arg_index; i++) {
+        fprintf(header, "extern %s arg%d;\n", real_type, i);
+    }
+    for (int i = 0; i < function_count; i++) {
+        // The generated code starts with the prototype and the declarations of its specializations
+        fprintf(header, "%.*s", (int)functions[i].declaration_size, functions[i].generated_code);
+    }
+    fclose(header);
+
+    FILE *units[MAX_COMPILE_UNITS];
+    size_t unit_sizes[MAX_COMPILE_UNITS];
+    for (int u = 0; u < compile_units; u++) {
+        snprintf(filename, sizeof(filename), "ml_%d_%d.c", pid, u);
+        units[u] = fopen(filename, "w");
+        if (!units[u]) {
+            error_log("FILE", "Could not create %s\n", filename);
+            while (u-- > 0) fclose(units[u]);
+            return EXIT_FAILURE;
+        }
+        fprintf(units[u], "#include \"ml_%d.h\"\n\n", pid);
+        unit_sizes[u] = 0;
+    }
+
+    generate_global_variables(units[0]);
+    fputs(generated_main, units[0]);
+    unit_sizes[0] = strlen(generated_main);
+
+    // Give each function to the unit with the least code so far; for --compile-report, keep main
+    // alone and deal the functions out in order, several to a unit past MAX_COMPILE_UNITS
+    for (int i = 0; i < function_count; i++) {
+        const char *definition = functions[i].generated_code + functions[i].declaration_size;
+        int smallest = 0;
+        if (compile_report) {
+            smallest = compile_units > 1 ? 1 + i % (compile_units - 1) : 0;
+        }
+        for (int u = 1; u < compile_units && !compile_report; u++) {
+            if (unit_sizes[u] < unit_sizes[smallest]) smallest = u;
+        }
+        fputs(definition, units[smallest]);
+        unit_sizes[smallest] += strlen(definition);
+        functions[i].compile_unit = smallest;
+    }
+
+    for (int u = 0; u < compile_units; u++) {
+        fclose(units[u]);
+    }
+    return EXIT_SUCCESS;
 }
 
 /**
- * Main function of the runml transpiler.
- * Parses command-line arguments and controls the overall process.
+ * Compiles the translation units concurrently, one cc process per unit, then links them.
+ * @param pid - The process ID, used for creating the unique filenames.
+ * @param compile_flags - Flags for compiling each unit.
+ * @param link_flags - Extra flags for the link step.
+ * @param output_filename - The linked program.
+ * @return - EXIT_SUCCESS on successful compilation, EXIT_FAILURE on error.
  */
-int main(int argc, char *argv[]) {
-    if (argc < 2 || argc > 3) {
-        usage(argv[0]);
+int compile_translation_units(pid_t pid, const char *compile_flags, const char *link_flags, const char *output_filename) {
+    if (write_translation_units(pid) != EXIT_SUCCESS) {
         return EXIT_FAILURE;
     }
 
-    // Check if verbose mode is enabled via the -v flag
-    if (argc == 3 && strcmp(argv[2], "-v") == 0) {
-        verbose = 1;
-        debug_log("INFO", "Verbose mode enabled\n");
+    debug_log("INFO", "Compiling ml_%d.c as %d units%s\n", pid, compile_units, compile_report ? " one at a time" : " in parallel");
+    fflush(stdout);
+
+    int result = EXIT_SUCCESS;
+    double unit_seconds[MAX_COMPILE_UNITS];
+    if (compile_report) {
+        // One unit at a time, so no unit's time includes waiting for a core
+        for (int u = 0; u < compile_units; u++) {
+            char compile_command[512];
+            snprintf(compile_command, sizeof(compile_command), "cc %s -c -o ml_%d_%d.o ml_%d_%d.c", compile_flags, pid, u, pid, u);
+            double start = now_seconds();
+            if (system(compile_command) != 0) {
+                result = EXIT_FAILURE;
+            }
+            unit_seconds[u] = now_seconds() - start;
+        }
+    } else {
+        pid_t compilers[MAX_COMPILE_UNITS];
+        for (int u = 0; u < compile_units; u++) {
+            compilers[u] = fork();
+            if (compilers[u] == 0) {
+                char compile_command[512];
+                snprintf(compile_command, sizeof(compile_command), "cc %s -c -o ml_%d_%d.o ml_%d_%d.c", compile_flags, pid, u, pid, u);
+                _exit(system(compile_command) == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+            }
+        }
+        for (int u = 0; u < compile_units; u++) {
+            int status;
+            if (compilers[u] < 0 || waitpid(compilers[u], &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+                result = EXIT_FAILURE;
+            }
+        }
     }
-    else if (argc == 3 && strcmp(argv[2], "-v") != 0) {
-        usage(argv[0]);
+    if (result != EXIT_SUCCESS) {
+        error_log("FILE", "Compilation failed for ml_%d.c\n", pid);
         return EXIT_FAILURE;
     }
 
-    const char *ml_filename = argv[1];
-
-    // Open the ml file for reading
-    FILE *ml_file = open_ml_file(ml_filename);
-    if (!ml_file) {
+    char link_command[4096];
+    size_t length = snprintf(link_command, sizeof(link_command), "cc %s -o '%s'", link_flags, output_filename);
+    for (int u = 0; u < compile_units && length < sizeof(link_command); u++) {
+        length += snprintf(link_command + length, sizeof(link_command) - length, " ml_%d_%d.o", pid, u);
+    }
+    if (length >= sizeof(link_command) ||
+        (size_t)snprintf(link_command + length, sizeof(link_command) - length, "%s", program_libraries()) >= sizeof(link_command) - length) {
+        error_log("FILE", "Link command too long for ml_%d.c\n", pid);
         return EXIT_FAILURE;
     }
-
-    // First pass: Parse and store function definitions and global variables
-    first_pass(ml_file);
-
-    // Create a temporary C file to store the translated code
-    FILE *c_file = create_c_file();
-    if (!c_file) {
-        fclose(ml_file);
+    debug_log("INFO", "Linking with command: %s\n", link_command);
+    double start = now_seconds();
+    if (system(link_command) != 0) {
+        error_log("FILE", "Linking failed for ml_%d.c\n", pid);
         return EXIT_FAILURE;
     }
+    if (compile_report) {
+        print_compile_report(pid, unit_seconds, now_seconds() - start);
+    }
+    return EXIT_SUCCESS;
+}
 
-    // Second pass: Generate the C code from the ml file
-    second_pass(ml_file, c_file);
+/**
+ * Prints the --compile-report table to stderr: one row per translation unit, slowest to compile
+ * first, with its compile time, the size of its object file and the machine code in it. A unit
+ * holding several functions (more than MAX_COMPILE_UNITS - 1 of them) lists them all. The code
+ * size is the sum of the function symbols nm lists, so it includes a function's specialized
+ * clones and outlined parallel repeat blocks; it shows "-" without nm. The main unit also holds
+ * the globals and runml's runtime.
+ * @param pid - The process ID, used for naming the object files.
+ * @param unit_seconds - The compile time of each unit.
+ * @param link_seconds - The time taken to link the units.
+ */
+void print_compile_report(pid_t pid, const double *unit_seconds, double link_seconds) {
+    int order[MAX_COMPILE_UNITS];
+    double total_seconds = 0;
+    for (int u = 0; u < compile_units; u++) {
+        // Insertion sort, slowest first
+        int position = u;
+        while (position > 0 && unit_seconds[order[position - 1]] < unit_seconds[u]) {
+            order[position] = order[position - 1];
+            position--;
+        }
+        order[position] = u;
+        total_seconds += unit_seconds[u];
+    }
 
-    fclose(ml_file);
-    fclose(c_file);
+    fprintf(stderr, "Compile report: %d unit%s, %.3f s compiling, %.3f s linking\n", compile_units, compile_units == 1 ? "" : "s", total_seconds, link_seconds);
+    fprintf(stderr, "%10s %12s %12s  %s\n", "compile_s", "object_bytes", "code_bytes", "function");
+    for (int i = 0; i < compile_units; i++) {
+        int u = order[i];
+        char object_filename[64];
+        snprintf(object_filename, sizeof(object_filename), "ml_%d_%d.o", pid, u);
+        struct stat object_stat;
+        long long object_bytes = stat(object_filename, &object_stat) == 0 ? (long long)object_stat.st_size : -1;
 
-    // Get the current process ID to create unique filenames
-    pid_t pid = getpid();
+        // Text symbols: "<address> <size> T <name>"
+        long long code_bytes = -1;
+        char command[128];
+        snprintf(command, sizeof(command), "nm -S --defined-only %s 2>/dev/null", object_filename);
+        FILE *symbols = popen(command, "r");
+        char symbol[MAX_LINE_LENGTH];
+        while (symbols && fgets(symbol, sizeof(symbol), symbols)) {
+            unsigned long long address, size;
+            char type;
+            if (sscanf(symbol, "%llx %llx %c", &address, &size, &type) == 3 && (type == 'T' || type == 't')) {
+                code_bytes = (code_bytes < 0 ? 0 : code_bytes) + (long long)size;
+            }
+        }
+        if (symbols) pclose(symbols);
 
-    // Compile the C file
-    if (compile_c_program(pid) != 0) {
-        return EXIT_FAILURE;
+        char names[MAX_LINE_LENGTH] = "main";
+        size_t names_length = u > 0 ? 0 : strlen(names);
+        for (int f = 0; u > 0 && f < function_count && names_length < sizeof(names); f++) {
+            if (functions[f].compile_unit == u) {
+                names_length += snprintf(names + names_length, sizeof(names) - names_length, "%s%s", names_length ? "," : "", functions[f].name);
+            }
+        }
+        char object_text[32] = "-", code_text[32] = "-";
+        if (object_bytes >= 0) snprintf(object_text, sizeof(object_text), "%lld", object_bytes);
+        if (code_bytes >= 0) snprintf(code_text, sizeof(code_text), "%lld", code_bytes);
+        fprintf(stderr, "%10.4f %12s %12s  %s\n", unit_seconds[u], object_text, code_text, names);
     }
+}
+
+/**
+ * Loads the compiled shared object into the runner process (zygote mode).
+ * Dynamic linking and relocation happen once here; every run afterwards only pays for a fork.
+ * The library is the one at program_path.
+ * @return - EXIT_SUCCESS if the entry point was found, EXIT_FAILURE on error.
+ */
+int load_c_program(void) {
+    const char *library_filename = program_path;
 
-    // Execute the compiled C program
-    if (execute_c_program(pid, argc, argv) != 0) {
+    program_handle = dlopen(library_filename, RTLD_NOW | RTLD_LOCAL);
+    if (!program_handle) {
+        error_log("FILE", "Could not load %s: %s\n", library_filename, dlerror());
         return EXIT_FAILURE;
     }
 
-    // Clean up temporary files
-    clean_up(pid);
+    *(void **)(&program_entry) = dlsym(program_handle, "ml_entry");
+    if (!program_entry) {
+        error_log("FILE", "No entry point in %s\n", library_filename);
+        dlclose(program_handle);
+        program_handle = NULL;
+        return EXIT_FAILURE;
+    }
 
+    debug_log("INFO", "Loaded %s into the zygote\n", library_filename);
     return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
+
+/**
+ * Executes the compiled C program in a forked child.
+ * When the program has been loaded into the zygote, the child calls its entry point directly;
+ * otherwise it execs the compiled binary at program_path. Arguments are passed as-is and never
+ * through a shell, so they cannot inject commands.
+ * @param pid - The process ID, used for creating the unique filename.
+ * @param argc - The number of program arguments.
+ * @param argv - The program arguments (values for arg0, arg1, ...).
+ * @param output_filename - File that receives the program's stdout, or NULL to inherit stdout.
+ * @return - EXIT_SUCCESS on successful execution, EXIT_FAILURE on error.
+ */
+int execute_c_program(pid_t pid, int argc, char *argv[], const char *output_filename) {
+    char program_name[64];
+    snprintf(program_name, sizeof(program_name), "ml_%d", pid);
+
+    char *run_argv[argc + 2];
+    run_argv[0] = program_entry ? program_name : program_path;
+    for (int i = 0; i < argc; i++) {
+        run_argv[i + 1] = argv[i];
+    }
+    run_argv[argc + 1] = NULL;
+
+    debug_log("INFO", "Running %s with %d argument(s)\n", program_entry ? "the zygote" : program_path, argc);
+    fflush(stdout);  // Do not let the child inherit pending output
+    fflush(stderr);
+
+    pid_t child = fork();
+    if (child < 0) {
+        error_log("FILE", "Could not fork to run ml_%d\n", pid);
+        return EXIT_FAILURE;
+    }
+    if (child == 0) {
+        if (output_filename && !freopen(output_filename, "w", stdout)) {
+            _exit(EXIT_FAILURE);
+        }
+        if (program_entry) {
+            int status = program_entry(argc + 1, run_argv);
+            fflush(stdout);
+            _exit(status);
+        }
+        execv(program_path, run_argv);
+        _exit(127);
+    }
+
+    int status;
+    if (waitpid(child, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        error_log("FILE", "Execution failed for ml_%d\n", pid);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Computes a 64-bit FNV-1a hash, continuing from a previous hash value.
+ * @param hash - The running hash (start with 14695981039346656037).
+ * @param data - The bytes to hash.
+ * @param length - Number of bytes.
+ * @return - The updated hash.
+ */
+uint64_t hash_bytes(uint64_t hash, const void *data, size_t length) {
+    const unsigned char *bytes = data;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/**
+ * Checks whether two characters written without whitespace between them would read as a different
+ * C token sequence than with it, e.g. "x y" and "xy", or "- -" and "--".
+ * @param previous - The last character written.
+ * @param next - The character to write after it.
+ * @return 1 if the whitespace between them has to be kept, 0 otherwise.
+ */
+int tokens_would_merge(char previous, char next) {
+    int previous_word = isalnum((unsigned char)previous) || previous == '_';
+    int next_word = isalnum((unsigned char)next) || next == '_';
+    if (previous_word && next_word) return 1;
+    if (next == '=' && strchr("+-*/%<>=!&|^", previous)) return 1;
+    return (previous == next && strchr("+-&|<>", next)) || (previous == '-' && next == '>') || (previous == '/' && (next == '*' || next == '/'));
+}
+
+/**
+ * Hashes the generated C file in a canonical form, which identifies the program independently of
+ * its ml file name and of cosmetic edits to it. Comments and all whitespace that does not separate
+ * tokens are dropped, and the top-level items (declarations, function definitions and main) are
+ * hashed in sorted order, so reordering functions or globals in the ml file, which only moves
+ * their items, keeps the hash. What the program does is still covered: the inferred types and the
+ * statement order within main and each function are part of the items, as are the line numbers
+ * and source lines that --line-counts compiles in.
+ * @param pid - The process ID, used for creating the unique filename.
+ * @return - The hash of ml_<pid>.c, or 0 if it could not be read.
+ */
+uint64_t hash_c_program(pid_t pid) {
+    char c_filename[64];
+    snprintf(c_filename, sizeof(c_filename), "ml_%d.c", pid);
+    char *text = NULL;
+    size_t text_size = 0;
+    FILE *text_file = open_memstream(&text, &text_size);
+    int copied = text_file && copy_file_to_stream(c_filename, text_file);
+    if (text_file) fclose(text_file);
+    char *canonical = copied ? malloc(text_size + 1) : NULL;
+    char **items = copied ? malloc((text_size / 2 + 2) * sizeof(char *)) : NULL;  // An item takes at least two bytes
+    if (!canonical || !items) {
+        free(text);
+        free(canonical);
+        free(items);
+        return 0;
+    }
+
+    // Split into top-level items: a line at brace depth 0 ends the item it completes
+    size_t length = 0, item_start = 0;
+    int item_count = 0, depth = 0, line_start = 1, directive = 0, space = 0;
+    for (size_t i = 0; i < text_size; i++) {
+        char c = text[i];
+        if (c == '/' && text[i + 1] == '/') {
+            while (i + 1 < text_size && text[i + 1] != '\n') i++;
+            continue;
+        }
+        if (c == '/' && text[i + 1] == '*') {
+            for (i += 2; i + 1 < text_size && !(text[i] == '*' && text[i + 1] == '/'); i++);
+            i++;
+            space = 1;
+            continue;
+        }
+        if (c == '\n') {
+            if (depth == 0 && length > item_start) {
+                canonical[length++] = '\0';
+                items[item_count++] = canonical + item_start;
+                item_start = length;
+            } else if (directive) {
+                canonical[length++] = '\n';  // A preprocessor line inside an item ends at the newline
+            }
+            directive = 0;
+            line_start = 1;
+            space = 0;
+            continue;
+        }
+        if (isspace((unsigned char)c)) {
+            space = 1;
+            continue;
+        }
+        if (space && length > item_start && tokens_would_merge(canonical[length - 1], c)) {
+            canonical[length++] = ' ';
+        }
+        space = 0;
+        directive |= line_start && c == '#';
+        line_start = 0;
+        depth += (c == '{') - (c == '}');
+        canonical[length++] = c;
+        if (c == '"' || c == '\'') {
+            // Literals are kept as written, including their whitespace
+            for (i++; i < text_size && text[i] != c && text[i] != '\n'; i++) {
+                if (text[i] == '\\' && i + 1 < text_size) canonical[length++] = text[i++];
+                canonical[length++] = text[i];
+            }
+            if (i < text_size && text[i] == c) canonical[length++] = c;
+            else i--;
+        }
+    }
+    if (length > item_start) {
+        canonical[length++] = '\0';
+        items[item_count++] = canonical + item_start;
+    }
+    qsort(items, item_count, sizeof(char *), compare_strings);
+
+    uint64_t hash = 14695981039346656037ULL;
+    for (int i = 0; i < item_count; i++) {
+        hash = hash_bytes(hash, items[i], strlen(items[i]) + 1);  // With the terminator between items
+    }
+    free(text);
+    free(canonical);
+    free(items);
+    return hash;
+}
+
+/**
+ * Returns the cache directory, creating it on first use.
+ * Uses $RUNML_CACHE_DIR if set, otherwise $HOME/.cache/runml.
+ * @return - Path of the cache directory, or NULL if it is unavailable.
+ */
+const char *cache_directory(void) {
+    static char directory[512];
+    if (directory[0]) {
+        return directory;
+    }
+
+    const char *configured = getenv("RUNML_CACHE_DIR");
+    if (configured && configured[0]) {
+        snprintf(directory, sizeof(directory), "%s", configured);
+    } else {
+        const char *home = getenv("HOME");
+        if (!home) {
+            return NULL;
+        }
+        char parent[400];
+        snprintf(parent, sizeof(parent), "%s/.cache", home);
+        mkdir(parent, 0755);
+        snprintf(directory, sizeof(directory), "%s/runml", parent);
+    }
+
+    struct stat info;
+    if (mkdir(directory, 0755) != 0 && (stat(directory, &info) != 0 || !S_ISDIR(info.st_mode))) {
+        error_log("FILE", "Could not create cache directory %s\n", directory);
+        directory[0] = '\0';
+        return NULL;
+    }
+    return directory;
+}
+
+/**
+ * Builds the result cache key from the program hash and the normalized argument values.
+ * Only the arguments the program references count, and each is normalized to the value
+ * the program will see (atof), so "2", "2.0" and "+2" share an entry.
+ * @param argc - The number of program arguments.
+ * @param argv - The program arguments.
+ * @return - The cache key.
+ */
+uint64_t result_cache_key(int argc, char *argv[]) {
+    uint64_t key = hash_bytes(14695981039346656037ULL, &program_hash, sizeof(program_hash));
+    for (int i = 0; i <= max_arg_index; i++) {
+        char normalized[64];
+        snprintf(normalized, sizeof(normalized), "%.17g", i < argc ? atof(argv[i]) : 0.0);
+        key = hash_bytes(key, normalized, strlen(normalized) + 1);
+    }
+    return key;
+}
+
+/**
+ * Counts a run of the program with these argument values in the cache's argument profile,
+ * <key>.args, which holds the count and the values. The file is locked while it is updated,
+ * so concurrent runs are all counted.
+ * @param argc - The number of program arguments.
+ * @param argv - The program arguments.
+ * @return - The number of runs with these values so far, including this one, or 0 without a cache.
+ */
+int record_argument_values(int argc, char *argv[]) {
+    const char *directory = cache_directory();
+    if (!directory) {
+        return 0;
+    }
+
+    char profile_filename[600];
+    snprintf(profile_filename, sizeof(profile_filename), "%s/%016" PRIx64 ".args", directory, result_cache_key(argc, argv));
+    int fd = open(profile_filename, O_RDWR | O_CREAT, 0644);
+    if (fd < 0 || lockf(fd, F_LOCK, 0) != 0) {
+        if (fd >= 0) close(fd);
+        return 0;
+    }
+
+    char profile[1024];
+    ssize_t length = read(fd, profile, sizeof(profile) - 1);
+    profile[length > 0 ? length : 0] = '\0';
+    int count = atoi(profile) + 1;
+
+    length = snprintf(profile, sizeof(profile), "%d", count);
+    for (int i = 0; i <= max_arg_index && length < (ssize_t)sizeof(profile); i++) {
+        length += snprintf(profile + length, sizeof(profile) - length, " %.17g", i < argc ? atof(argv[i]) : 0.0);
+    }
+    if (length >= (ssize_t)sizeof(profile)) length = sizeof(profile) - 1;
+    profile[length++] = '\n';
+    if (lseek(fd, 0, SEEK_SET) != 0 || !write_all(fd, profile, length) || ftruncate(fd, length) != 0) {
+        count = 0;
+    }
+    close(fd);  // Releases the lock
+    debug_log("INFO", "Argument values %s seen %d times\n", profile_filename, count);
+    return count;
+}
+
+/**
+ * Copies a file to an output stream.
+ * @param filename - The file to copy.
+ * @param stream - The destination stream.
+ * @return - 1 on success, 0 if the file could not be read.
+ */
+int copy_file_to_stream(const char *filename, FILE *stream) {
+    FILE *file = fopen(filename, "r");
+    if (!file) {
+        return 0;
+    }
+    char buffer[4096];
+    size_t length;
+    while ((length = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        fwrite(buffer, 1, length, stream);
+    }
+    fclose(file);
+    fflush(stream);
+    return 1;
+}
+
+/**
+ * Replays a cached result: prints the stored output and returns the stored exit status.
+ * Entries older than RESULT_CACHE_TTL, and failed runs stored by older versions, are removed and
+ * treated as misses.
+ * @param key - The result cache key.
+ * @param status - Receives the cached exit status on a hit.
+ * @return - 1 on a cache hit, 0 on a miss.
+ */
+int replay_cached_result(uint64_t key, int *status) {
+    const char *directory = cache_directory();
+    if (!directory) {
+        return 0;
+    }
+
+    char entry_filename[600];
+    snprintf(entry_filename, sizeof(entry_filename), "%s/%016" PRIx64 ".result", directory, key);
+
+    struct stat info;
+    if (stat(entry_filename, &info) != 0) {
+        return 0;
+    }
+    if (time(NULL) - info.st_mtime > RESULT_CACHE_TTL) {
+        debug_log("INFO", "Cached result %016" PRIx64 " expired\n", key);
+        remove(entry_filename);
+        return 0;
+    }
+
+    FILE *entry = fopen(entry_filename, "r");
+    if (!entry || fscanf(entry, "%d", status) != 1 || fgetc(entry) != '\n') {
+        if (entry) fclose(entry);
+        return 0;
+    }
+    if (*status != EXIT_SUCCESS) {
+        fclose(entry);
+        remove(entry_filename);
+        return 0;
+    }
+
+    debug_log("INFO", "Replaying cached result %016" PRIx64 "\n", key);
+    char buffer[4096];
+    size_t length;
+    while ((length = fread(buffer, 1, sizeof(buffer), entry)) > 0) {
+        fwrite(buffer, 1, length, stdout);
+    }
+    fclose(entry);
+    fflush(stdout);
+    return 1;
+}
+
+/**
+ * Stores a program's exit status and captured output in the result cache.
+ * Only successful runs are stored: a crash, kill or interrupt says nothing about the next run.
+ * The entry is written to a temporary file and renamed so readers never see a partial entry,
+ * then the cache is trimmed to RESULT_CACHE_MAX_BYTES.
+ * @param key - The result cache key.
+ * @param status - The program's exit status.
+ * @param output_filename - File holding the captured output.
+ */
+void store_cached_result(uint64_t key, int status, const char *output_filename) {
+    const char *directory = cache_directory();
+    struct stat info;
+    if (!directory || status != EXIT_SUCCESS || stat(output_filename, &info) != 0 || info.st_size > RESULT_CACHE_MAX_OUTPUT) {
+        return;
+    }
+
+    char entry_filename[600];
+    char temp_filename[640];
+    snprintf(entry_filename, sizeof(entry_filename), "%s/%016" PRIx64 ".result", directory, key);
+    snprintf(temp_filename, sizeof(temp_filename), "%s.%d.tmp", entry_filename, getpid());
+
+    FILE *entry = fopen(temp_filename, "w");
+    if (!entry) {
+        return;
+    }
+    fprintf(entry, "%d\n", status);
+    fclose(entry);
+
+    entry = fopen(temp_filename, "a");
+    int copied = entry && copy_file_to_stream(output_filename, entry);
+    if (entry) fclose(entry);
+    if (!copied || rename(temp_filename, entry_filename) != 0) {
+        remove(temp_filename);
+        return;
+    }
+    debug_log("INFO", "Stored result %016" PRIx64 " in the cache\n", key);
+    trim_result_cache(directory);
+}
+
+/**
+ * Removes expired results from the cache, then the least recently stored ones until all
+ * results together take at most RESULT_CACHE_MAX_BYTES. Binaries and argument profiles are kept.
+ * @param directory - The cache directory.
+ */
+void trim_result_cache(const char *directory) {
+    DIR *listing = opendir(directory);
+    if (!listing) {
+        return;
+    }
+
+    CachedResult *results = NULL;
+    int result_count = 0, result_capacity = 0;
+    long long total_bytes = 0;
+    time_t now = time(NULL);
+    char entry_filename[600];
+    struct dirent *entry;
+    while ((entry = readdir(listing)) != NULL) {
+        size_t length = strlen(entry->d_name);
+        if (length <= 7 || length >= sizeof(results->filename) || strcmp(entry->d_name + length - 7, ".result") != 0) {
+            continue;
+        }
+        snprintf(entry_filename, sizeof(entry_filename), "%s/%s", directory, entry->d_name);
+        struct stat info;
+        if (stat(entry_filename, &info) != 0) {
+            continue;
+        }
+        if (now - info.st_mtime > RESULT_CACHE_TTL) {
+            remove(entry_filename);
+            continue;
+        }
+        if (result_count == result_capacity) {
+            result_capacity = result_capacity ? result_capacity * 2 : 64;
+            CachedResult *grown = realloc(results, result_capacity * sizeof(CachedResult));
+            if (!grown) break;
+            results = grown;
+        }
+        strcpy(results[result_count].filename, entry->d_name);
+        results[result_count].modified = info.st_mtime;
+        results[result_count].size = info.st_size;
+        result_count++;
+        total_bytes += info.st_size;
+    }
+    closedir(listing);
+
+    if (total_bytes > RESULT_CACHE_MAX_BYTES) {
+        qsort(results, result_count, sizeof(CachedResult), compare_cached_results);
+        for (int i = 0; i < result_count && total_bytes > RESULT_CACHE_MAX_BYTES; i++) {
+            snprintf(entry_filename, sizeof(entry_filename), "%s/%s", directory, results[i].filename);
+            if (remove(entry_filename) == 0) {
+                debug_log("INFO", "Evicted cached result %s\n", results[i].filename);
+            }
+            total_bytes -= results[i].size;
+        }
+    }
+    free(results);
+}
+
+/**
+ * Orders cached results oldest first.
+ * @param first - Pointer to the first CachedResult.
+ * @param second - Pointer to the second CachedResult.
+ * @return - Negative, zero or positive like strcmp.
+ */
+int compare_cached_results(const void *first, const void *second) {
+    const CachedResult *a = first, *b = second;
+    return (a->modified > b->modified) - (a->modified < b->modified);
+}
+
+/**
+ * Executes the program, going through the result cache when it is enabled and the program is deterministic.
+ * On a miss the output is captured to ml_<pid>.out, copied to stdout and stored.
+ * @param pid - The process ID, used for creating the unique filename.
+ * @param argc - The number of program arguments.
+ * @param argv - The program arguments.
+ * @return - EXIT_SUCCESS on successful execution, EXIT_FAILURE on error.
+ */
+int execute_and_cache(pid_t pid, int argc, char *argv[]) {
+    if (!cache_results || !program_is_deterministic) {
+        return execute_c_program(pid, argc, argv, NULL);
+    }
+
+    uint64_t key = result_cache_key(argc, argv);
+    int status;
+    if (replay_cached_result(key, &status)) {
+        return status;
+    }
+
+    char output_filename[64];
+    snprintf(output_filename, sizeof(output_filename), "ml_%d.out", pid);
+    status = execute_c_program(pid, argc, argv, output_filename);
+    copy_file_to_stream(output_filename, stdout);
+    store_cached_result(key, status, output_filename);
+    remove(output_filename);
+    return status;
+}
+
+/**
+ * Formats a number the way print does: integers without decimals, anything else with six.
+ * @param buffer - Receives the text.
+ * @param size - Size of the buffer.
+ * @param value - The number.
+ */
+void format_number(char *buffer, size_t size, double value) {
+    if (fabs(value) < 9.2e18 && fabs(value - (int64_t)value) < 1e-6) {
+        snprintf(buffer, size, "%" PRId64, (int64_t)value);
+    } else {
+        snprintf(buffer, size, "%.6f", value);
+    }
+}
+
+/**
+ * Square root by Newton's method, so runml itself does not need the math library.
+ * @param value - A non-negative number.
+ * @return - Its square root.
+ */
+double square_root(double value) {
+    if (value <= 0) return 0.0;
+    double root = value > 1 ? value : 1.0;
+    for (;;) {
+        double next = 0.5 * (root + value / root);
+        if (next >= root) return root;
+        root = next;
+    }
+}
+
+/**
+ * Runs trial_count trials of the compiled program over one process per core. Each process gets
+ * a contiguous range of trial numbers, which are also the random stream ids, and records what
+ * every trial prints. The values are then combined per print statement in trial order, so the
+ * mean, standard deviation, minimum and maximum only depend on the seed.
+ * @param pid - The process ID, used for creating the unique filenames.
+ * @param argc - Number of program arguments.
+ * @param argv - The program arguments.
+ * @return - EXIT_SUCCESS if every trial ran, EXIT_FAILURE otherwise.
+ */
+int run_trials(pid_t pid, int argc, char *argv[]) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    uint64_t processes = cores < 1 ? 1 : (uint64_t)cores;
+    if (processes > trial_count) processes = trial_count;
+    if (processes > MAX_COMPILE_UNITS) processes = MAX_COMPILE_UNITS;
+    debug_log("INFO", "Running %" PRIu64 " trials in %" PRIu64 " processes\n", trial_count, processes);
+    fflush(stdout);
+    fflush(stderr);
+
+    char *child_argv[argc + 2];
+    child_argv[0] = program_path;
+    for (int i = 0; i < argc; i++) {
+        child_argv[i + 1] = argv[i];
+    }
+    child_argv[argc + 1] = NULL;
+
+    pid_t children[MAX_COMPILE_UNITS];
+    char filename[64];
+    uint64_t first = 0;
+    for (uint64_t p = 0; p < processes; p++) {
+        uint64_t count = trial_count / processes + (p < trial_count % processes);
+        snprintf(filename, sizeof(filename), "ml_%d.trials%" PRIu64, pid, p);
+        children[p] = fork();
+        if (children[p] == 0) {
+            char range[64];
+            snprintf(range, sizeof(range), "%" PRIu64 " %" PRIu64, first, count);
+            setenv("RUNML_TRIALS", range, 1);
+            if (!freopen(filename, "w", stdout)) _exit(EXIT_FAILURE);
+            execv(program_path, child_argv);
+            _exit(EXIT_FAILURE);
+        }
+        first += count;
+    }
+
+    int result = EXIT_SUCCESS;
+    for (uint64_t p = 0; p < processes; p++) {
+        int status;
+        if (children[p] < 0 || waitpid(children[p], &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            result = EXIT_FAILURE;
+        }
+    }
+    if (result != EXIT_SUCCESS) {
+        error_log("FILE", "Execution failed for ml_%d\n", pid);
+    }
+
+    // Welford's running mean and variance per print statement, fed in trial order
+    typedef struct { uint64_t count; double mean, m2, min, max; } TrialSummary;
+    TrialSummary *summaries = NULL;
+    int summary_count = 0;
+    for (uint64_t p = 0; p < processes; p++) {
+        snprintf(filename, sizeof(filename), "ml_%d.trials%" PRIu64, pid, p);
+        FILE *values = result == EXIT_SUCCESS ? fopen(filename, "r") : NULL;
+        int index;
+        double value;
+        while (values && fscanf(values, "%d %lf", &index, &value) == 2 && index >= 0) {
+            if (index >= summary_count) {
+                TrialSummary *grown = realloc(summaries, (index + 1) * sizeof(TrialSummary));
+                if (!grown) break;
+                summaries = grown;
+                memset(summaries + summary_count, 0, (index + 1 - summary_count) * sizeof(TrialSummary));
+                summary_count = index + 1;
+            }
+            TrialSummary *summary = &summaries[index];
+            if (summary->count == 0 || value < summary->min) summary->min = value;
+            if (summary->count == 0 || value > summary->max) summary->max = value;
+            summary->count++;
+            double delta = value - summary->mean;
+            summary->mean += delta / summary->count;
+            summary->m2 += delta * (value - summary->mean);
+        }
+        if (values) fclose(values);
+        remove(filename);
+    }
+
+    for (int i = 0; i < summary_count; i++) {
+        char mean[64], deviation[64], low[64], high[64];
+        TrialSummary *summary = &summaries[i];
+        format_number(mean, sizeof(mean), summary->mean);
+        format_number(deviation, sizeof(deviation), summary->count > 1 ? square_root(summary->m2 / (summary->count - 1)) : 0.0);
+        format_number(low, sizeof(low), summary->min);
+        format_number(high, sizeof(high), summary->max);
+        printf("mean %s sd %s min %s max %s\n", mean, deviation, low, high);
+    }
+    free(summaries);
+    return result;
+}
+
+/**
+ * Runs the zygote loop: every line read from stdin is one set of program arguments,
+ * and each set is executed in its own forked child of the already-initialized runner.
+ * @param pid - The process ID, used for creating the unique filename.
+ * @return - EXIT_SUCCESS if every run succeeded, EXIT_FAILURE otherwise.
+ */
+int run_zygote(pid_t pid) {
+    char line[MAX_LINE_LENGTH];
+    int result = EXIT_SUCCESS;
+
+    debug_log("INFO", "Zygote ready, reading argument sets from stdin\n");
+    while (fgets(line, sizeof(line), stdin)) {
+        line[strcspn(line, "\n")] = '\0';  // Remove newline character
+
+        char *run_argv[MAX_IDENTIFIERS];
+        int run_argc = 0;
+        char *arg = strtok(line, " \t");
+        while (arg != NULL && run_argc < MAX_IDENTIFIERS) {
+            run_argv[run_argc++] = arg;
+            arg = strtok(NULL, " \t");
+        }
+
+        if (execute_and_cache(pid, run_argc, run_argv) != EXIT_SUCCESS) {
+            result = EXIT_FAILURE;
+        }
+    }
+    return result;
+}
+
+/**
+ * Writes the --opt-report report: the ml source with the compiler's remarks under the line they
+ * were attributed to through #line, each with the function it belongs to. GCC's "optimized" and
+ * clang's -Rpass remarks are reported as applied, "missed" and -Rpass-missed as missed, and
+ * clang's -Rpass-analysis as the reasons behind a miss. Remarks about code that no ml line
+ * produced are only counted, and those about library calls are left out.
+ * @param pid - The process ID, used for naming the remarks file.
+ * @param ml_filename - Path to the ml file, as named in the #line directives.
+ * @return - EXIT_SUCCESS if the report was written, EXIT_FAILURE otherwise.
+ */
+int write_opt_report(pid_t pid, const char *ml_filename) {
+    char remarks_filename[64];
+    snprintf(remarks_filename, sizeof(remarks_filename), "ml_%d.remarks", pid);
+    FILE *remarks = fopen(remarks_filename, "r");
+    FILE *ml_file = fopen(ml_filename, "r");
+    FILE *report = fopen(opt_report_path, "w");
+    if (!remarks || !ml_file || !report) {
+        error_log("FILE", "Could not write the optimization report %s\n", opt_report_path);
+        if (remarks) fclose(remarks);
+        if (ml_file) fclose(ml_file);
+        if (report) fclose(report);
+        return EXIT_FAILURE;
+    }
+
+    // Collect the distinct remarks of each line as "kind: text\n"
+    char **line_remarks = calloc(source_line_count + 1, sizeof(char *));
+    int applied = 0, missed = 0, generated = 0;
+    size_t name_length = strlen(ml_filename);
+    char remark[MAX_LINE_LENGTH * 4];
+    while (fgets(remark, sizeof(remark), remarks)) {
+        remark[strcspn(remark, "\n")] = '\0';
+        char *location_end = strstr(remark, ": ");
+        char kind[16];
+        int offset = 0;
+        if (!location_end || sscanf(location_end + 2, "%15[a-z]: %n", kind, &offset) != 1 || offset == 0) {
+            continue;  // Not a remark: a continuation line or a statistic
+        }
+        char *text = location_end + 2 + offset;
+        const char *category = strcmp(kind, "optimized") == 0 ? "applied" : strcmp(kind, "missed") == 0 ? "missed" : NULL;
+        if (strcmp(kind, "remark") == 0) {
+            char *tag = strstr(text, " [-Rpass");
+            category = !tag ? NULL : strncmp(tag, " [-Rpass=", 9) == 0 ? "applied" : strncmp(tag, " [-Rpass-missed=", 16) == 0 ? "missed" : "reason";
+            if (tag) *tag = '\0';
+        }
+        if (!category || strstr(text, "function body not available") || strncmp(text, "statement clobbers memory", 25) == 0) {
+            continue;  // Library calls such as printf, which can be neither inlined nor vectorized around
+        }
+
+        int line = 0;
+        if (strncmp(remark, ml_filename, name_length) == 0 && remark[name_length] == ':') {
+            line = atoi(remark + name_length + 1);
+        }
+        if (line < 1 || line > source_line_count || !line_remarks) {
+            generated++;
+            continue;
+        }
+        char entry[sizeof(remark) + 16];
+        snprintf(entry, sizeof(entry), "%s: %s\n", category, text);
+        if (line_remarks[line] && strstr(line_remarks[line], entry)) {
+            continue;  // Repeated for another copy of the code, such as a specialized clone
+        }
+        size_t length = line_remarks[line] ? strlen(line_remarks[line]) : 0;
+        char *grown = realloc(line_remarks[line], length + strlen(entry) + 1);
+        if (!grown) {
+            continue;
+        }
+        strcpy(grown + length, entry);
+        line_remarks[line] = grown;
+        applied += strcmp(category, "applied") == 0;
+        missed += strcmp(category, "missed") == 0;
+    }
+    fclose(remarks);
+
+    fprintf(report, "# Optimization remarks for %s: %d applied, %d missed, %d more in generated code\n", ml_filename, applied, missed, generated);
+    char line[MAX_LINE_LENGTH];
+    char function_name[MAX_IDENTIFIER_LENGTH + 1] = "main";
+    for (int n = 1; n <= source_line_count && fgets(line, sizeof(line), ml_file); n++) {
+        line[strcspn(line, "\n")] = '\0';
+        if (strncmp(line, "function ", 9) == 0) {
+            sscanf(line + 9, "%12s", function_name);
+        } else if (line[0] != '\t') {
+            strcpy(function_name, "main");  // Back at the top level once the indented body ends
+        }
+        fprintf(report, "%5d  %s\n", n, line);
+        for (const char *entry = line_remarks ? line_remarks[n] : NULL; entry && *entry; ) {
+            size_t length = strcspn(entry, "\n");
+            fprintf(report, "       [%s] %.*s\n", function_name, (int)length, entry);
+            entry += length + 1;
+        }
+    }
+    fclose(ml_file);
+    for (int n = 0; line_remarks && n <= source_line_count; n++) {
+        free(line_remarks[n]);
+    }
+    free(line_remarks);
+    if (fclose(report) != 0) {
+        error_log("FILE", "Could not write the optimization report %s\n", opt_report_path);
+        return EXIT_FAILURE;
+    }
+    debug_log("INFO", "Wrote the optimization report %s\n", opt_report_path);
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Cleans up the temporary files (the .c file and the compiled binary or shared object).
+ * @param pid - The process ID, used for creating the unique filenames.
+ */
+void clean_up(pid_t pid) {
+    debug_log("INFO", "Cleaning up temporary files\n");
+    if (program_handle) {
+        dlclose(program_handle);
+        program_handle = NULL;
+        program_entry = NULL;
+    }
+    char c_filename[64];
+    snprintf(c_filename, sizeof(c_filename), "ml_%d.c", pid);  // Format: ml_<PID>.c
+    remove(c_filename);  // Remove the C file
+    if (compile_units > 1 || compile_report) {
+        snprintf(c_filename, sizeof(c_filename), "ml_%d.h", pid);
+        remove(c_filename);
+        for (int u = 0; u < compile_units; u++) {
+            snprintf(c_filename, sizeof(c_filename), "ml_%d_%d.c", pid, u);
+            remove(c_filename);
+            snprintf(c_filename, sizeof(c_filename), "ml_%d_%d.o", pid, u);
+            remove(c_filename);
+        }
+    }
+    if (opt_report) {
+        snprintf(c_filename, sizeof(c_filename), "ml_%d.remarks", pid);
+        remove(c_filename);
+    }
+    if (!cache_binaries) {
+        remove(program_path);  // Remove the compiled program; cached binaries are kept
+    }
+}
+
+/**
+ * Returns a monotonic timestamp for measuring phase durations.
+ * @return - Seconds since an arbitrary fixed point.
+ */
+double now_seconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/**
+ * Transpiles an ml file into ml_<pid>.c.
+ * @param ml_filename - Path to the ml file.
+ * @return - EXIT_SUCCESS if the C file was written, EXIT_FAILURE otherwise.
+ */
+int transpile_ml_file(const char *ml_filename) {
+    // Open the ml file for reading
+    FILE *ml_file = open_ml_file(ml_filename);
+    if (!ml_file) {
+        return EXIT_FAILURE;
+    }
+
+    int result = transpile_ml_stream(ml_file);
+    fclose(ml_file);
+    return result;
+}
+
+/**
+ * Transpiles ml source from an open stream into ml_<pid>.c.
+ * @param ml_file - The ml source; it must support rewind().
+ * @return - EXIT_SUCCESS if the C file was written, EXIT_FAILURE otherwise.
+ */
+int transpile_ml_stream(FILE *ml_file) {
+    // First pass: Parse and store function definitions and global variables
+    first_pass(ml_file);
+    if (row_input) {
+        program_is_deterministic = 0;  // The output depends on stdin, not only on the arguments
+    }
+    if (line_counts) {
+        program_is_deterministic = 0;  // A replayed result would not write the counts
+    }
+
+    // Large programs are compiled as several translation units, one per core
+    compile_units = requested_units;
+    if (compile_units == 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        compile_units = function_count >= PARALLEL_COMPILE_THRESHOLD && cores > 1 ? (int)cores : 1;
+    }
+    if (compile_units > function_count + 1) compile_units = function_count + 1;
+    if (compile_units > MAX_COMPILE_UNITS) compile_units = MAX_COMPILE_UNITS;
+    if (compile_units < 1 || constant_arguments) compile_units = 1;  // Constant arguments are defined in the one unit
+    if (opt_report) compile_units = 1;  // The remarks are read from a single compiler run
+    if (compile_report) {
+        // main and each function on its own, as far as the unit limit allows
+        compile_units = function_count + 1 < MAX_COMPILE_UNITS ? function_count + 1 : MAX_COMPILE_UNITS;
+    }
+
+    // Create a temporary C file to store the translated code
+    FILE *c_file = open_c_file = create_c_file();
+    if (!c_file) {
+        return EXIT_FAILURE;
+    }
+
+    // Second pass: Generate the C code from the ml file
+    second_pass(ml_file, c_file);
+
+    fclose(c_file);
+    open_c_file = NULL;
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Forgets everything the passes recorded about the previous program,
+ * so several ml files can be transpiled by one process. This includes the scope and the open
+ * files of a translation that a syntax error abandoned (see run_precompile()).
+ */
+void reset_transpiler_state(void) {
+    if (open_c_file) fclose(open_c_file);
+    open_c_file = NULL;
+    if (parallel_code_file) fclose(parallel_code_file);
+    parallel_code_file = NULL;
+    parallel_block_count = 0;
+    visible_global_count = -1;
+    translating_function = NULL;
+    translating_parallel_body = 0;
+    emitting_bench_call = 0;
+    current_ml_line = 0;
+    mapped_ml_line = 0;
+    function_count = 0;
+    global_var_count = 0;
+    local_var_count = 0;
+    max_arg_index = -1;
+    referenced_args = 0;
+    program_is_deterministic = 1;
+    program_uses_parallel = 0;
+    program_uses_matrices = 0;
+    program_uses_random = 0;
+    program_uses_timing = 0;
+    program_hash = 0;
+    source_line_count = 0;
+}
+
+/**
+ * Reads a whole ml file into memory with a single open/fstat/read sequence.
+ * @param buffer - The buffer to fill; its filename must be set.
+ * @return - 1 on success, 0 if the file could not be read.
+ */
+int read_source_file(SourceBuffer *buffer) {
+    int fd = open(buffer->filename, O_RDONLY);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0) {
+        if (fd >= 0) close(fd);
+        return 0;
+    }
+
+    buffer->source = malloc(info.st_size + 1);
+    int complete = buffer->source && read_exact(fd, buffer->source, info.st_size);
+    close(fd);
+    if (!complete) {
+        free(buffer->source);
+        buffer->source = NULL;
+        return 0;
+    }
+    buffer->source[info.st_size] = '\0';
+    buffer->length = info.st_size;
+    return 1;
+}
+
+/**
+ * Loader thread: claims files one at a time, reads them, and publishes each as it completes.
+ * @param argument - The shared SourceLoader.
+ * @return - NULL.
+ */
+void *source_loader_thread(void *argument) {
+    SourceLoader *loader = argument;
+    for (;;) {
+        pthread_mutex_lock(&loader->lock);
+        int index = loader->next < loader->count ? loader->next++ : -1;
+        pthread_mutex_unlock(&loader->lock);
+        if (index < 0) {
+            return NULL;
+        }
+
+        int loaded = read_source_file(&loader->buffers[index]) ? 1 : -1;
+
+        pthread_mutex_lock(&loader->lock);
+        loader->buffers[index].loaded = loaded;
+        loader->completed[loader->completed_count++] = index;
+        pthread_cond_signal(&loader->ready);
+        pthread_mutex_unlock(&loader->lock);
+    }
+}
+
+/**
+ * Precompile mode: transpiles and compiles many ml files into the binary cache.
+ * Loader threads read the sources concurrently and each file is transpiled as soon as
+ * its buffer is complete, so file loading overlaps with transpilation.
+ * @param file_count - Number of ml files.
+ * @param filenames - The ml files.
+ * @return - EXIT_SUCCESS if every file compiled, EXIT_FAILURE otherwise.
+ */
+int run_precompile(int file_count, char *filenames[]) {
+    SourceLoader loader;
+    loader.buffers = calloc(file_count, sizeof(SourceBuffer));
+    loader.completed = calloc(file_count, sizeof(int));
+    if (!loader.buffers || !loader.completed) {
+        error_log("FILE", "Out of memory for %d files\n", file_count);
+        free(loader.buffers);
+        free(loader.completed);
+        return EXIT_FAILURE;
+    }
+    loader.count = file_count;
+    loader.next = 0;
+    loader.completed_count = 0;
+    pthread_mutex_init(&loader.lock, NULL);
+    pthread_cond_init(&loader.ready, NULL);
+    for (int i = 0; i < file_count; i++) {
+        loader.buffers[i].filename = filenames[i];
+    }
+
+    pthread_t threads[SOURCE_LOADER_THREADS];
+    int thread_count = 0;
+    while (thread_count < file_count && thread_count < SOURCE_LOADER_THREADS &&
+           pthread_create(&threads[thread_count], NULL, source_loader_thread, &loader) == 0) {
+        thread_count++;
+    }
+    if (thread_count == 0) {
+        source_loader_thread(&loader);  // No thread could be started: load every file here first
+    }
+
+    cache_binaries = 1;
+    pid_t pid = getpid();
+    int result = EXIT_SUCCESS;
+    for (int processed = 0; processed < file_count; processed++) {
+        pthread_mutex_lock(&loader.lock);
+        while (loader.completed_count <= processed) {
+            pthread_cond_wait(&loader.ready, &loader.lock);
+        }
+        SourceBuffer *buffer = &loader.buffers[loader.completed[processed]];
+        pthread_mutex_unlock(&loader.lock);
+
+        // An empty file is a valid (empty) program; fmemopen() may refuse a zero-length buffer
+        FILE *ml_file = buffer->loaded != 1 ? NULL :
+                        buffer->length > 0 ? fmemopen(buffer->source, buffer->length, "r") : fopen("/dev/null", "r");
+        if (!ml_file) {
+            error_log("FILE", "Could not open file %s\n", buffer->filename);
+            result = EXIT_FAILURE;
+            continue;
+        }
+
+        // A syntax error jumps back here instead of exiting, so the rest of the batch still compiles
+        debug_log("INFO", "Precompiling %s\n", buffer->filename);
+        reset_transpiler_state();
+        jmp_buf recovery;
+        check_recovery = &recovery;
+        if (setjmp(recovery) == 0) {
+            if (transpile_ml_stream(ml_file) != EXIT_SUCCESS || compile_c_program(pid) != EXIT_SUCCESS) {
+                result = EXIT_FAILURE;
+            }
+        } else {
+            error_log("FILE", "Skipped %s after a syntax error\n", buffer->filename);
+            reset_transpiler_state();
+            result = EXIT_FAILURE;
+        }
+        check_recovery = NULL;
+        fclose(ml_file);
+        clean_up(pid);
+        free(buffer->source);
+        buffer->source = NULL;
+    }
+
+    for (int i = 0; i < thread_count; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    pthread_mutex_destroy(&loader.lock);
+    pthread_cond_destroy(&loader.ready);
+    free(loader.buffers);
+    free(loader.completed);
+    return result;
+}
+
+/**
+ * Check mode: parses and type-checks many ml files without generating a program or invoking cc.
+ * Both passes run as usual, writing into /dev/null, and every error is reported with its file and
+ * line instead of stopping at the first one.
+ * @param file_count - Number of ml files.
+ * @param filenames - The ml files.
+ * @return - EXIT_SUCCESS if every file is valid, EXIT_FAILURE otherwise.
+ */
+int run_check(int file_count, char *filenames[]) {
+    FILE *discard = fopen("/dev/null", "w");
+    if (!discard) {
+        error_log("FILE", "Could not open /dev/null\n");
+        return EXIT_FAILURE;
+    }
+
+    check_mode = 1;
+    compile_units = 1;
+    int invalid_files = 0;
+    int total_errors = 0;
+    for (int i = 0; i < file_count; i++) {
+        check_filename = filenames[i];
+        check_error_count = 0;
+        reset_transpiler_state();
+
+        FILE *ml_file = fopen(filenames[i], "r");
+        check_pass = 1;
+        if (!ml_file) {
+            error_log("FILE", "Could not open file\n");
+        } else {
+            CHECKED_STEP(first_pass(ml_file));
+            rewind(ml_file);
+            check_pass = 2;
+            CHECKED_STEP(second_pass(ml_file, discard));
+            fclose(ml_file);
+        }
+        current_ml_line = 0;
+        print_check_diagnostics();
+
+        if (check_error_count == 0) {
+            printf("%s: ok\n", filenames[i]);
+        } else {
+            printf("%s: %d error%s\n", filenames[i], check_error_count, check_error_count == 1 ? "" : "s");
+            invalid_files++;
+            total_errors += check_error_count;
+        }
+    }
+    fclose(discard);
+
+    printf("%d file%s checked, %d with errors, %d error%s\n", file_count, file_count == 1 ? "" : "s", invalid_files, total_errors, total_errors == 1 ? "" : "s");
+    return invalid_files == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/**
+ * Runs one ml file through the full transpile, compile and execute pipeline.
+ * @param ml_filename - Path to the ml file.
+ * @param argc - The number of program arguments.
+ * @param argv - The program arguments.
+ * @param timings - Receives the time spent in each phase (may be NULL).
+ * @return - EXIT_SUCCESS if the program ran successfully, EXIT_FAILURE otherwise.
+ */
+int run_ml_file(const char *ml_filename, int argc, char *argv[], PhaseTimings *timings) {
+    PhaseTimings phases = {0, 0, 0};
+    double start = now_seconds();
+
+    if (transpile_ml_file(ml_filename) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+    phases.transpile = now_seconds() - start;
+
+    // Get the current process ID to create unique filenames
+    pid_t pid = getpid();
+    int result = EXIT_SUCCESS;
+
+    // A cached result for these arguments makes compiling and running unnecessary
+    if (cache_results && program_is_deterministic) {
+        program_hash = hash_c_program(pid);
+        int status;
+        if (!zygote_mode && replay_cached_result(result_cache_key(argc, argv), &status)) {
+            clean_up(pid);
+            if (timings) *timings = phases;
+            return status;
+        }
+    }
+
+    // Argument values this program has often run with are compiled into a variant of it
+    uint64_t generic_hash = program_hash;
+    if (specialize_arguments && max_arg_index >= 0) {
+        start = now_seconds();
+        if (!program_hash) {
+            program_hash = generic_hash = hash_c_program(pid);
+        }
+        // Non-finite values (inf, nan) have no C literal and keep the generic program
+        int finite = 1;
+        for (int i = 0; i <= max_arg_index && i < argc; i++) {
+            finite = finite && isfinite(atof(argv[i]));
+        }
+        if (finite && record_argument_values(argc, argv) >= SPECIALIZE_ARGS_THRESHOLD &&
+            (constant_arguments = calloc(max_arg_index + 1, sizeof(double))) != NULL) {
+            for (int i = 0; i <= max_arg_index && i < argc; i++) {
+                constant_arguments[i] = atof(argv[i]);
+            }
+            debug_log("INFO", "Using a variant with %d constant arguments\n", max_arg_index + 1);
+            reset_transpiler_state();
+            result = transpile_ml_file(ml_filename);
+        }
+        phases.transpile += now_seconds() - start;
+    }
+
+    // Compile the C file
+    start = now_seconds();
+    if (result != EXIT_SUCCESS || compile_c_program(pid) != 0) {
+        free(constant_arguments);
+        constant_arguments = NULL;
+        return EXIT_FAILURE;
+    }
+    phases.compile = now_seconds() - start;
+    if (opt_report) {
+        write_opt_report(pid, ml_filename);
+    }
+    if (constant_arguments) {
+        program_hash = generic_hash;  // Results stay keyed by the generic program, as the lookup above was
+        free(constant_arguments);
+        constant_arguments = NULL;
+    }
+
+    start = now_seconds();
+    if (zygote_mode) {
+        // Load once, then fork for every argument set read from stdin
+        result = load_c_program() == EXIT_SUCCESS ? run_zygote(pid) : EXIT_FAILURE;
+    } else if (trial_count > 0) {
+        result = run_trials(pid, argc, argv);
+    } else {
+        // Execute the compiled C program
+        result = execute_and_cache(pid, argc, argv);
+    }
+    phases.execute = now_seconds() - start;
+
+    // Clean up temporary files
+    clean_up(pid);
+
+    if (timings) *timings = phases;
+    return result;
+}
+
+/**
+ * Transpiles an ml file and keeps the generated C as a single file, without compiling or running it.
+ * Used to inspect the emitted code and to benchmark it against hand-written C.
+ * @param ml_filename - Path to the ml file.
+ * @param c_filename - Where to write the generated C.
+ * @return - EXIT_SUCCESS if the C file was written, EXIT_FAILURE otherwise.
+ */
+int emit_c_program(const char *ml_filename, const char *c_filename) {
+    requested_units = 1;  // One self-contained file, whatever the program size
+    if (transpile_ml_file(ml_filename) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+
+    pid_t pid = getpid();
+    char generated_filename[64];
+    snprintf(generated_filename, sizeof(generated_filename), "ml_%d.c", pid);
+    FILE *output = fopen(c_filename, "w");
+    if (!output) {
+        error_log("FILE", "Could not create %s\n", c_filename);
+        clean_up(pid);
+        return EXIT_FAILURE;
+    }
+    int result = copy_file_to_stream(generated_filename, output) ? EXIT_SUCCESS : EXIT_FAILURE;
+    if (fclose(output) != 0) {
+        result = EXIT_FAILURE;
+    }
+    if (result != EXIT_SUCCESS) {
+        error_log("FILE", "Could not write %s\n", c_filename);
+    }
+    clean_up(pid);
+    return result;
+}
+
+/**
+ * Runs the compiled program once with its output redirected to a file, measuring the run.
+ * A loaded zygote is forked; otherwise the executable is started with execv.
+ * @param pid - The process ID, used for naming the program.
+ * @param argc - The number of program arguments.
+ * @param argv - The program arguments.
+ * @param output_filename - Receives the program's stdout.
+ * @param seconds - Receives the wall time from fork to exit.
+ * @param peak_kilobytes - Receives the peak resident set size of the run.
+ * @return - EXIT_SUCCESS if the program exited with status 0, EXIT_FAILURE otherwise.
+ */
+int measure_program_run(pid_t pid, int argc, char *argv[], const char *output_filename, double *seconds, long *peak_kilobytes) {
+    char program_name[64];
+    snprintf(program_name, sizeof(program_name), "ml_%d", pid);
+    char *run_argv[argc + 2];
+    run_argv[0] = program_entry ? program_name : program_path;
+    for (int i = 0; i < argc; i++) {
+        run_argv[i + 1] = argv[i];
+    }
+    run_argv[argc + 1] = NULL;
+
+    fflush(stdout);
+    fflush(stderr);
+    double start = now_seconds();
+    pid_t child = fork();
+    if (child < 0) {
+        error_log("FILE", "Could not fork to run ml_%d\n", pid);
+        return EXIT_FAILURE;
+    }
+    if (child == 0) {
+        if (!freopen(output_filename, "w", stdout)) {
+            _exit(EXIT_FAILURE);
+        }
+        if (program_entry) {
+            int status = program_entry(argc + 1, run_argv);
+            fflush(stdout);
+            _exit(status);
+        }
+        execv(program_path, run_argv);
+        _exit(127);
+    }
+
+    int status;
+    struct rusage usage;
+    if (wait4(child, &status, 0, &usage) < 0) {
+        error_log("FILE", "Could not wait for ml_%d\n", pid);
+        return EXIT_FAILURE;
+    }
+    *seconds = now_seconds() - start;
+    *peak_kilobytes = usage.ru_maxrss;  // Kilobytes on Linux
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/**
+ * Compares two files byte for byte.
+ * @param first_filename - The first file.
+ * @param second_filename - The second file.
+ * @return - 1 if both files could be read and have the same contents, 0 otherwise.
+ */
+int files_identical(const char *first_filename, const char *second_filename) {
+    FILE *first = fopen(first_filename, "rb");
+    FILE *second = fopen(second_filename, "rb");
+    int identical = first && second;
+    while (identical) {
+        int a = fgetc(first);
+        int b = fgetc(second);
+        if (a != b) {
+            identical = 0;
+        } else if (a == EOF) {
+            break;
+        }
+    }
+    if (first) fclose(first);
+    if (second) fclose(second);
+    return identical;
+}
+
+/**
+ * Runs one program through every engine runml has: a build at -O0, a build at -O2, a build
+ * reused from the binary cache and a zygote-loaded shared object. The program is transpiled once.
+ * Prints the output of the first engine, then per engine the startup latency (compiling, cache
+ * lookup or loading), execution time and peak memory, and whether its output is byte-identical.
+ * @param ml_filename - Path to the ml file.
+ * @param argc - The number of program arguments.
+ * @param argv - The program arguments.
+ * @return - EXIT_SUCCESS if every engine ran and produced the same output, EXIT_FAILURE otherwise.
+ */
+int run_comparison(const char *ml_filename, int argc, char *argv[]) {
+    static const struct {
+        const char *name;
+        const char *optimization;  // NULL keeps the default flags
+        int cached;
+        int zygote;
+    } engines[] = {
+        { "O0", " -O0", 0, 0 },
+        { "O2", " -O2", 0, 0 },
+        { "cached", NULL, 1, 0 },
+        { "zygote", NULL, 0, 1 },
+    };
+    int engine_count = sizeof(engines) / sizeof(engines[0]);
+
+    double start = now_seconds();
+    if (transpile_ml_file(ml_filename) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+    double transpile_seconds = now_seconds() - start;
+    pid_t pid = getpid();
+
+    char reference_filename[64];
+    snprintf(reference_filename, sizeof(reference_filename), "ml_%d.%s.out", pid, engines[0].name);
+    char report[2048];
+    int report_length = snprintf(report, sizeof(report), "\n%-8s %12s %12s %14s  %s\n", "engine", "startup_ms", "execute_ms", "peak_rss_kb", "output");
+    int result = EXIT_SUCCESS;
+
+    for (int e = 0; e < engine_count; e++) {
+        optimization_flags = engines[e].optimization;
+        cache_binaries = engines[e].cached;
+        zygote_mode = engines[e].zygote;
+        char output_filename[64];
+        snprintf(output_filename, sizeof(output_filename), "ml_%d.%s.out", pid, engines[e].name);
+
+        // The cached engine is warmed first, so its startup is the cost of a cache hit
+        int status = engines[e].cached ? compile_c_program(pid) : EXIT_SUCCESS;
+        start = now_seconds();
+        if (status == EXIT_SUCCESS) {
+            status = compile_c_program(pid);
+        }
+        if (status == EXIT_SUCCESS && engines[e].zygote) {
+            status = load_c_program();
+        }
+        double startup_seconds = now_seconds() - start;
+
+        double execute_seconds = 0;
+        long peak_kilobytes = 0;
+        if (status == EXIT_SUCCESS) {
+            status = measure_program_run(pid, argc, argv, output_filename, &execute_seconds, &peak_kilobytes);
+        }
+
+        const char *verdict = "failed";
+        if (status != EXIT_SUCCESS) {
+            result = EXIT_FAILURE;
+        } else if (e == 0) {
+            verdict = "reference";
+            copy_file_to_stream(output_filename, stdout);
+        } else if (files_identical(reference_filename, output_filename)) {
+            verdict = "identical";
+        } else {
+            verdict = "DIFFERENT";
+            result = EXIT_FAILURE;
+        }
+        if (report_length < (int)sizeof(report)) {
+            report_length += snprintf(report + report_length, sizeof(report) - report_length, "%-8s %12.1f %12.1f %14ld  %s\n",
+                                      engines[e].name, startup_seconds * 1000, execute_seconds * 1000, peak_kilobytes, verdict);
+        }
+
+        if (program_handle) {
+            dlclose(program_handle);
+            program_handle = NULL;
+            program_entry = NULL;
+        }
+        if (!cache_binaries) {
+            remove(program_path);
+        }
+        if (e > 0) {
+            remove(output_filename);
+        }
+    }
+    remove(reference_filename);
+
+    printf("%s", report);
+    printf("transpile %.1f ms, shared by every engine\n", transpile_seconds * 1000);
+    if (result != EXIT_SUCCESS) {
+        error_log("FILE", "Not every engine ran %s to the same output\n", ml_filename);
+    }
+
+    optimization_flags = NULL;
+    cache_binaries = 0;
+    zygote_mode = 0;
+    clean_up(pid);
+    return result;
+}
+
+/**
+ * Verify mode for --precision=f32: builds and runs the program with double and with float reals,
+ * then prints the f32 output and compares every number in it with the f64 one. Both builds print
+ * reals with all their digits (print_all_digits), and the f32 output is shown rounded the way
+ * print rounds it. The error of a value is |f32 - f64| / max(|f64|, 1), so
+ * the tolerance is relative for large values and absolute for small ones. Values beyond the
+ * tolerance are listed, and the other output must match exactly.
+ * @param ml_filename - Path to the ml file.
+ * @param argc - The number of program arguments.
+ * @param argv - The program arguments.
+ * @param tolerance - The largest acceptable error.
+ * @return - EXIT_SUCCESS if both builds ran and every value is within the tolerance, EXIT_FAILURE otherwise.
+ */
+int run_precision_check(const char *ml_filename, int argc, char *argv[], double tolerance) {
+    static const char *precisions[] = { "double", "float" };
+    pid_t pid = getpid();
+    char output_filenames[2][64];
+    int result = EXIT_SUCCESS;
+
+    print_all_digits = 1;
+    for (int p = 0; p < 2 && result == EXIT_SUCCESS; p++) {
+        real_type = precisions[p];
+        snprintf(output_filenames[p], sizeof(output_filenames[p]), "ml_%d.%s.out", pid, real_type);
+        double seconds;
+        long peak_kilobytes;
+        reset_transpiler_state();
+        if (transpile_ml_file(ml_filename) != EXIT_SUCCESS || compile_c_program(pid) != EXIT_SUCCESS ||
+            measure_program_run(pid, argc, argv, output_filenames[p], &seconds, &peak_kilobytes) != EXIT_SUCCESS) {
+            error_log("FILE", "The %s build of %s did not run\n", real_type, ml_filename);
+            result = EXIT_FAILURE;
+        }
+        clean_up(pid);
+    }
+
+    FILE *reference = result == EXIT_SUCCESS ? fopen(output_filenames[0], "r") : NULL;
+    FILE *single = result == EXIT_SUCCESS ? fopen(output_filenames[1], "r") : NULL;
+    if (result == EXIT_SUCCESS && (!reference || !single)) {
+        error_log("FILE", "Could not read the outputs of %s\n", ml_filename);
+        result = EXIT_FAILURE;
+    }
+
+    int values = 0, beyond = 0, mismatched = 0;
+    double largest_error = 0;
+    char reference_line[MAX_LINE_LENGTH * 4], single_line[MAX_LINE_LENGTH * 4];
+    while (single && fgets(single_line, sizeof(single_line), single)) {
+        // The program's own output, with the numbers rounded as --precision=f32 prints them
+        for (const char *cursor = single_line; *cursor;) {
+            size_t separator = strspn(cursor, " \t\n");
+            fwrite(cursor, 1, separator, stdout);
+            cursor += separator;
+            size_t length = strcspn(cursor, " \t\n");
+            char *end;
+            double value = strtod(cursor, &end);
+            char number[64];
+            if (length > 0 && end == cursor + length) {
+                format_number(number, sizeof(number), value);
+                fputs(number, stdout);
+            } else {
+                fwrite(cursor, 1, length, stdout);
+            }
+            cursor += length;
+        }
+    }
+    if (single) rewind(single);
+    for (int line = 1; reference && single; line++) {
+        char *reference_text = fgets(reference_line, sizeof(reference_line), reference);
+        char *single_text = fgets(single_line, sizeof(single_line), single);
+        if (!reference_text || !single_text) {
+            mismatched += reference_text != single_text;
+            break;
+        }
+
+        // Compare token by token: numbers within the tolerance, anything else exactly
+        char *reference_save, *single_save;
+        char *reference_token = strtok_r(reference_line, " \t\n", &reference_save);
+        char *single_token = strtok_r(single_line, " \t\n", &single_save);
+        while (reference_token || single_token) {
+            char *reference_end = NULL, *single_end = NULL;
+            double expected = reference_token ? strtod(reference_token, &reference_end) : 0;
+            double actual = single_token ? strtod(single_token, &single_end) : 0;
+            if (reference_token && single_token && *reference_end == '\0' && *single_end == '\0' && reference_end != reference_token && single_end != single_token) {
+                double difference = actual > expected ? actual - expected : expected - actual;
+                double magnitude = expected < 0 ? -expected : expected;
+                double error = difference / (magnitude > 1 ? magnitude : 1);
+                if (!(error <= largest_error)) largest_error = error;  // NaN counts as the largest
+                if (!(error <= tolerance)) {
+                    printf("line %d: f64 %s, f32 %s, error %.3g\n", line, reference_token, single_token, error);
+                    beyond++;
+                }
+                values++;
+            } else if (!reference_token || !single_token || strcmp(reference_token, single_token) != 0) {
+                printf("line %d: f64 printed \"%s\", f32 printed \"%s\"\n", line, reference_token ? reference_token : "", single_token ? single_token : "");
+                mismatched++;
+            }
+            reference_token = strtok_r(NULL, " \t\n", &reference_save);
+            single_token = strtok_r(NULL, " \t\n", &single_save);
+        }
+    }
+    if (reference) fclose(reference);
+    if (single) fclose(single);
+    remove(output_filenames[0]);
+    remove(output_filenames[1]);
+    real_type = "float";
+    print_all_digits = 0;
+
+    if (result == EXIT_SUCCESS) {
+        printf("%d value%s compared, largest error %.3g, %d beyond the tolerance %g, %d other difference%s\n",
+               values, values == 1 ? "" : "s", largest_error, beyond, tolerance, mismatched, mismatched == 1 ? "" : "s");
+        if (beyond > 0 || mismatched > 0) {
+            result = EXIT_FAILURE;
+        }
+    }
+    return result;
+}
+
+/**
+ * Orders doubles ascending, for qsort.
+ * @param first - The first double.
+ * @param second - The second double.
+ * @return - Negative, zero or positive as first is less than, equal to or greater than second.
+ */
+int compare_doubles(const void *first, const void *second) {
+    double a = *(const double *)first;
+    double b = *(const double *)second;
+    return (a > b) - (a < b);
+}
+
+/**
+ * Orders strings ascending, for qsort.
+ * @param first - Pointer to the first string.
+ * @param second - Pointer to the second string.
+ * @return - Negative, zero or positive as first sorts before, with or after second.
+ */
+int compare_strings(const void *first, const void *second) {
+    return strcmp(*(char *const *)first, *(char *const *)second);
+}
+
+/**
+ * Returns a percentile of sorted values by the nearest-rank method.
+ * @param sorted_values - The values, sorted ascending.
+ * @param count - The number of values (at least 1).
+ * @param fraction - The percentile as a fraction, e.g. 0.99.
+ * @return - The smallest value with at least that fraction of the values at or below it.
+ */
+double percentile(const double *sorted_values, int count, double fraction) {
+    int rank = (int)(fraction * count + 0.999999);  // ceil without libm
+    if (rank < 1) rank = 1;
+    if (rank > count) rank = count;
+    return sorted_values[rank - 1];
+}
+
+/**
+ * Runs the full transpile, compile and execute pipeline repeatedly and reports the latency
+ * distribution of each phase and of whole runs, plus throughput. The program's output is shown
+ * for the first run only. With the binary cache enabled, runs after the first reuse the compiled
+ * program, so the compile phase measures a warm cache.
+ * @param ml_filename - Path to the ml file.
+ * @param argc - The number of program arguments.
+ * @param argv - The program arguments.
+ * @param runs - How many times to run the pipeline.
+ * @return - EXIT_SUCCESS if every run succeeded, EXIT_FAILURE otherwise.
+ */
+int run_benchmark(const char *ml_filename, int argc, char *argv[], int runs) {
+    static const char *phase_names[] = { "transpile", "compile", "execute", "total" };
+    double *samples[4];
+    for (int p = 0; p < 4; p++) {
+        samples[p] = malloc(runs * sizeof(double));
+        if (!samples[p]) {
+            error_log("FILE", "Out of memory for %d benchmark runs\n", runs);
+            while (p-- > 0) free(samples[p]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    int saved_stdout = -1;
+    int completed = 0;
+    int result = EXIT_SUCCESS;
+    double start = now_seconds();
+    for (int r = 0; r < runs; r++) {
+        if (r == 1) {
+            // Later runs print the same output again; send it to /dev/null
+            fflush(stdout);
+            int null_fd = open("/dev/null", O_WRONLY);
+            saved_stdout = dup(STDOUT_FILENO);
+            if (null_fd >= 0 && saved_stdout >= 0) {
+                dup2(null_fd, STDOUT_FILENO);
+            }
+            if (null_fd >= 0) close(null_fd);
+        }
+        reset_transpiler_state();
+        PhaseTimings timings = {0, 0, 0};
+        if (run_ml_file(ml_filename, argc, argv, &timings) != EXIT_SUCCESS) {
+            result = EXIT_FAILURE;
+            break;
+        }
+        samples[0][r] = timings.transpile;
+        samples[1][r] = timings.compile;
+        samples[2][r] = timings.execute;
+        samples[3][r] = timings.transpile + timings.compile + timings.execute;
+        completed++;
+    }
+    double elapsed = now_seconds() - start;
+    if (saved_stdout >= 0) {
+        fflush(stdout);
+        dup2(saved_stdout, STDOUT_FILENO);
+        close(saved_stdout);
+    }
+
+    if (completed > 0) {
+        printf("\n%d run%s of %s%s\n", completed, completed == 1 ? "" : "s", ml_filename,
+               cache_binaries ? ", compiled program cached after the first run" : "");
+        printf("%-10s %10s %10s %10s %10s %10s  (ms)\n", "phase", "min", "median", "p90", "p99", "max");
+        for (int p = 0; p < 4; p++) {
+            qsort(samples[p], completed, sizeof(double), compare_doubles);
+            printf("%-10s %10.3f %10.3f %10.3f %10.3f %10.3f\n", phase_names[p], samples[p][0] * 1000,
+                   percentile(samples[p], completed, 0.5) * 1000, percentile(samples[p], completed, 0.9) * 1000,
+                   percentile(samples[p], completed, 0.99) * 1000, samples[p][completed - 1] * 1000);
+        }
+        printf("throughput %.2f runs/s\n", elapsed > 0 ? completed / elapsed : 0.0);
+    }
+    if (result != EXIT_SUCCESS) {
+        error_log("FILE", "Benchmark stopped after %d of %d runs\n", completed, runs);
+    }
+
+    for (int p = 0; p < 4; p++) {
+        free(samples[p]);
+    }
+    return result;
+}
+
+/**
+ * Claims the next job in the spool directory by atomically renaming <name>.ml to <name>.ml.running.
+ * Only one worker can win the rename, so jobs are never run twice.
+ * @param spool_directory - The spool directory.
+ * @param job_name - Receives the job name (the file name without .ml).
+ * @param job_name_size - Size of the job_name buffer.
+ * @return - 1 if a job was claimed, 0 if none is waiting.
+ */
+int claim_spool_job(const char *spool_directory, char *job_name, size_t job_name_size) {
+    DIR *directory = opendir(spool_directory);
+    if (!directory) {
+        return 0;
+    }
+
+    struct dirent *entry;
+    int claimed = 0;
+    while (!claimed && (entry = readdir(directory)) != NULL) {
+        size_t length = strlen(entry->d_name);
+        if (length <= 3 || length - 3 >= job_name_size || strcmp(entry->d_name + length - 3, ".ml") != 0) {
+            continue;
+        }
+
+        char job_filename[1024];
+        char claimed_filename[1100];
+        snprintf(job_filename, sizeof(job_filename), "%s/%s", spool_directory, entry->d_name);
+        snprintf(claimed_filename, sizeof(claimed_filename), "%s.running", job_filename);
+        if (rename(job_filename, claimed_filename) == 0) {
+            snprintf(job_name, job_name_size, "%.*s", (int)(length - 3), entry->d_name);
+            claimed = 1;
+        }
+    }
+    closedir(directory);
+    return claimed;
+}
+
+/**
+ * Runs one claimed spool job in a child process and writes its results next to it:
+ * <name>.out and <name>.err hold the program's stdout and stderr, and <name>.status holds the
+ * exit code and phase timings. The status file is written last via rename, so its presence
+ * means the job is complete. The job file itself ends up as <name>.ml.done.
+ * Arguments are read from <name>.args (whitespace separated) when present.
+ * @param spool_directory - The spool directory.
+ * @param job_name - The claimed job's name.
+ */
+void process_spool_job(const char *spool_directory, const char *job_name) {
+    char base[1024];
+    char running_filename[1100], done_filename[1100], args_filename[1100];
+    char out_filename[1100], err_filename[1100], status_filename[1100], temp_filename[1100];
+    snprintf(base, sizeof(base), "%s/%s", spool_directory, job_name);
+    snprintf(running_filename, sizeof(running_filename), "%s.ml.running", base);
+    snprintf(done_filename, sizeof(done_filename), "%s.ml.done", base);
+    snprintf(args_filename, sizeof(args_filename), "%s.args", base);
+    snprintf(out_filename, sizeof(out_filename), "%s.out", base);
+    snprintf(err_filename, sizeof(err_filename), "%s.err", base);
+    snprintf(status_filename, sizeof(status_filename), "%s.status", base);
+    snprintf(temp_filename, sizeof(temp_filename), "%s.status.%d.tmp", base, getpid());
+
+    debug_log("INFO", "Worker %d running job %s\n", getpid(), job_name);
+    fflush(stdout);
+    fflush(stderr);
+
+    pid_t child = fork();
+    if (child == 0) {
+        // Fresh transpiler state per job; the program's output goes to the result files
+        char args_buffer[MAX_LINE_LENGTH * 4] = "";
+        char *job_argv[MAX_IDENTIFIERS];
+        int job_argc = 0;
+        FILE *args_file = fopen(args_filename, "r");
+        if (args_file) {
+            size_t length = fread(args_buffer, 1, sizeof(args_buffer) - 1, args_file);
+            args_buffer[length] = '\0';
+            fclose(args_file);
+        }
+        char *arg = strtok(args_buffer, " \t\n");
+        while (arg != NULL && job_argc < MAX_IDENTIFIERS) {
+            job_argv[job_argc++] = arg;
+            arg = strtok(NULL, " \t\n");
+        }
+
+        if (!freopen(out_filename, "w", stdout) || !freopen(err_filename, "w", stderr)) {
+            _exit(EXIT_FAILURE);
+        }
+        verbose = 0;
+
+        PhaseTimings timings = {0, 0, 0};
+        int status = run_ml_file(running_filename, job_argc, job_argv, &timings);
+        fflush(stdout);
+        fflush(stderr);
+
+        FILE *status_file = fopen(temp_filename, "w");
+        if (status_file) {
+            fprintf(status_file, "exit %d\ntranspile %.6f\ncompile %.6f\nexecute %.6f\n",
+                    status, timings.transpile, timings.compile, timings.execute);
+            fclose(status_file);
+            rename(temp_filename, status_filename);
+        }
+        _exit(status);
+    }
+
+    int status = 0;
+    if (child < 0 || waitpid(child, &status, 0) < 0) {
+        status = -1;
+    }
+
+    // A job that stopped early (syntax error, crash) still gets a status file
+    if (access(status_filename, F_OK) != 0) {
+        int exit_code = child > 0 && WIFEXITED(status) ? WEXITSTATUS(status) : 128 + (WIFSIGNALED(status) ? WTERMSIG(status) : 0);
+        FILE *status_file = fopen(temp_filename, "w");
+        if (status_file) {
+            fprintf(status_file, "exit %d\n", exit_code);
+            fclose(status_file);
+            rename(temp_filename, status_filename);
+        }
+    }
+    rename(running_filename, done_filename);
+}
+
+/**
+ * The loop run by each worker process: claim and run jobs until the spool is empty,
+ * then sleep until the directory changes (inotify on Linux, polling elsewhere).
+ * @param spool_directory - The spool directory.
+ */
+void worker_loop(const char *spool_directory) {
+    int notify_fd = -1;
+#ifdef __linux__
+    notify_fd = inotify_init1(IN_CLOEXEC);
+    if (notify_fd >= 0 && inotify_add_watch(notify_fd, spool_directory, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        close(notify_fd);
+        notify_fd = -1;
+    }
+#endif
+
+    char job_name[256];
+    for (;;) {
+        while (claim_spool_job(spool_directory, job_name, sizeof(job_name))) {
+            process_spool_job(spool_directory, job_name);
+        }
+
+        if (notify_fd >= 0) {
+            // The timeout covers events that arrive between the scan and the wait
+            struct pollfd watch = { notify_fd, POLLIN, 0 };
+            if (poll(&watch, 1, 1000) > 0) {
+                char events[4096];
+                if (read(notify_fd, events, sizeof(events)) < 0 && errno != EINTR) {
+                    close(notify_fd);
+                    notify_fd = -1;
+                }
+            }
+        } else {
+            struct timespec interval = { 0, 200 * 1000 * 1000 };
+            nanosleep(&interval, NULL);
+        }
+    }
+}
+
+/**
+ * Worker mode: starts worker_count processes that share the spool directory and the binary cache.
+ * Runs until the workers are terminated.
+ * @param spool_directory - The directory that jobs are dropped into.
+ * @return - EXIT_FAILURE if the spool directory is unusable or a worker stops unexpectedly.
+ */
+int run_worker(const char *spool_directory) {
+    struct stat info;
+    if (stat(spool_directory, &info) != 0 || !S_ISDIR(info.st_mode)) {
+        error_log("FILE", "Spool directory %s does not exist\n", spool_directory);
+        return EXIT_FAILURE;
+    }
+
+    cache_binaries = 1;  // Jobs for the same program share one compile
+    debug_log("INFO", "Starting %d worker(s) on %s\n", worker_count, spool_directory);
+    fflush(stdout);
+
+    for (int i = 0; i < worker_count; i++) {
+        pid_t worker = fork();
+        if (worker < 0) {
+            error_log("FILE", "Could not start worker %d\n", i);
+            return EXIT_FAILURE;
+        }
+        if (worker == 0) {
+            worker_loop(spool_directory);
+            _exit(EXIT_SUCCESS);
+        }
+    }
+
+    while (wait(NULL) > 0) {
+        // Workers only return if they are killed
+    }
+    return EXIT_FAILURE;
+}
+
+/**
+ * Writes a whole buffer to a socket or file descriptor.
+ * @return - 1 on success, 0 on error.
+ */
+int write_all(int fd, const void *data, size_t length) {
+    const char *bytes = data;
+    while (length > 0) {
+        ssize_t written = write(fd, bytes, length);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) return 0;
+        bytes += written;
+        length -= written;
+    }
+    return 1;
+}
+
+/**
+ * Reads exactly length bytes from a socket or file descriptor.
+ * @return - 1 on success, 0 on error or end of stream.
+ */
+int read_exact(int fd, void *data, size_t length) {
+    char *bytes = data;
+    while (length > 0) {
+        ssize_t received = read(fd, bytes, length);
+        if (received < 0 && errno == EINTR) continue;
+        if (received <= 0) return 0;
+        bytes += received;
+        length -= received;
+    }
+    return 1;
+}
+
+/**
+ * Reads one protocol header line (without the newline) from a socket.
+ * Reads a byte at a time so no payload bytes are consumed.
+ * @return - 1 on success, 0 on error, end of stream or an overlong line.
+ */
+int read_line(int fd, char *line, size_t size) {
+    size_t length = 0;
+    char c;
+    while (read_exact(fd, &c, 1)) {
+        if (c == '\n') {
+            line[length] = '\0';
+            return 1;
+        }
+        if (length + 1 >= size) return 0;
+        line[length++] = c;
+    }
+    return 0;
+}
+
+/**
+ * Opens a listening TCP socket.
+ * @param address - IPv4 address to bind, e.g. "127.0.0.1" or "0.0.0.0".
+ * @param port - Port to bind (0 picks a free port); receives the bound port.
+ * @return - The listening socket, or -1 on error.
+ */
+int open_listener(const char *address, int *port) {
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_fd < 0) {
+        return -1;
+    }
+    int reuse = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    struct sockaddr_in bind_address;
+    memset(&bind_address, 0, sizeof(bind_address));
+    bind_address.sin_family = AF_INET;
+    bind_address.sin_port = htons(*port);
+    if (inet_pton(AF_INET, address, &bind_address.sin_addr) != 1 ||
+        bind(listen_fd, (struct sockaddr *)&bind_address, sizeof(bind_address)) != 0 ||
+        listen(listen_fd, 16) != 0) {
+        close(listen_fd);
+        return -1;
+    }
+
+    socklen_t length = sizeof(bind_address);
+    getsockname(listen_fd, (struct sockaddr *)&bind_address, &length);
+    *port = ntohs(bind_address.sin_port);
+    return listen_fd;
+}
+
+/**
+ * Connects to a worker host.
+ * @param host_spec - "host:port".
+ * @return - The connected socket, or -1 on error.
+ */
+int connect_to_host(const char *host_spec) {
+    char host[256];
+    char port[16];
+    const char *colon = strrchr(host_spec, ':');
+    if (!colon || colon == host_spec || (size_t)(colon - host_spec) >= sizeof(host) || strlen(colon + 1) >= sizeof(port)) {
+        error_log("FILE", "Invalid host %s (expected host:port)\n", host_spec);
+        return -1;
+    }
+    snprintf(host, sizeof(host), "%.*s", (int)(colon - host_spec), host_spec);
+    snprintf(port, sizeof(port), "%s", colon + 1);
+
+    struct addrinfo hints;
+    struct addrinfo *addresses;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, port, &hints, &addresses) != 0) {
+        error_log("FILE", "Could not resolve %s\n", host_spec);
+        return -1;
+    }
+
+    int connection_fd = -1;
+    for (struct addrinfo *address = addresses; address && connection_fd < 0; address = address->ai_next) {
+        connection_fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+        if (connection_fd >= 0 && connect(connection_fd, address->ai_addr, address->ai_addrlen) != 0) {
+            close(connection_fd);
+            connection_fd = -1;
+        }
+    }
+    freeaddrinfo(addresses);
+
+    if (connection_fd < 0) {
+        error_log("FILE", "Could not connect to %s\n", host_spec);
+    }
+    return connection_fd;
+}
+
+/**
+ * Handles one coordinator connection on a worker host. The protocol is line headers plus payloads:
+ *   coordinator -> worker: "PROGRAM <length>" + generated C, then "JOB <id> <argc>" + one argument per line
+ *   worker -> coordinator: "RESULT <id> <exit status> <length>" + the program's stdout
+ * Programs are compiled through the local binary cache, so repeated sweeps skip cc.
+ * @param connection_fd - The connected socket.
+ */
+void serve_coordinator(int connection_fd) {
+    pid_t pid = getpid();
+    char header[MAX_LINE_LENGTH];
+    char c_filename[64];
+    char output_filename[64];
+    snprintf(c_filename, sizeof(c_filename), "ml_%d.c", pid);
+    snprintf(output_filename, sizeof(output_filename), "ml_%d.out", pid);
+    int compiled = 0;
+
+    cache_binaries = 1;
+    while (read_line(connection_fd, header, sizeof(header))) {
+        size_t length;
+        long job_id;
+        int job_argc;
+
+        if (sscanf(header, "PROGRAM %zu", &length) == 1) {
+            char *source = malloc(length + 1);
+            FILE *c_file = fopen(c_filename, "w");
+            int received = source && read_exact(connection_fd, source, length);
+            if (received && c_file) {
+                fwrite(source, 1, length, c_file);
+                source[length] = '\0';
+                program_uses_parallel = strstr(source, "ml_parallel_for(") != NULL;  // Needs the thread flags
+                program_uses_matrices = strstr(source, "ml_matrix(") != NULL;  // Built with optimization
+                program_uses_random = strstr(source, "ml_random_start(") != NULL;  // Linked with the math library
+            }
+            if (c_file) fclose(c_file);
+            free(source);
+            if (!received) break;
+
+            program_hash = hash_c_program(pid);
+            compiled = compile_c_program(pid) == EXIT_SUCCESS;
+        } else if (sscanf(header, "JOB %ld %d", &job_id, &job_argc) == 2 && job_argc >= 0 && job_argc <= MAX_IDENTIFIERS) {
+            char arg_storage[MAX_IDENTIFIERS][MAX_LINE_LENGTH];
+            char *job_argv[MAX_IDENTIFIERS];
+            int received = 1;
+            for (int i = 0; i < job_argc && received; i++) {
+                received = read_line(connection_fd, arg_storage[i], sizeof(arg_storage[i]));
+                job_argv[i] = arg_storage[i];
+            }
+            if (!received) break;
+
+            int status = compiled ? execute_c_program(pid, job_argc, job_argv, output_filename) : EXIT_FAILURE;
+
+            char *output = NULL;
+            size_t output_length = 0;
+            FILE *output_file = compiled ? fopen(output_filename, "r") : NULL;
+            if (output_file) {
+                fseek(output_file, 0, SEEK_END);
+                output_length = ftell(output_file);
+                rewind(output_file);
+                output = malloc(output_length + 1);
+                output_length = output ? fread(output, 1, output_length, output_file) : 0;
+                fclose(output_file);
+            }
+
+            char response[128];
+            int response_length = snprintf(response, sizeof(response), "RESULT %ld %d %zu\n", job_id, status, output_length);
+            int sent = write_all(connection_fd, response, response_length) && write_all(connection_fd, output, output_length);
+            free(output);
+            if (!sent) break;
+        } else {
+            error_log("FILE", "Unexpected request from coordinator: %s\n", header);
+            break;
+        }
+    }
+
+    remove(c_filename);
+    remove(output_filename);
+    close(connection_fd);
+}
+
+/**
+ * Accepts coordinator connections forever, serving each in its own process.
+ * @param listen_fd - The listening socket.
+ */
+void serve_connections(int listen_fd) {
+    signal(SIGPIPE, SIG_IGN);
+    for (;;) {
+        int connection_fd = accept(listen_fd, NULL, NULL);
+        if (connection_fd < 0) {
+            if (errno == EINTR) continue;
+            error_log("FILE", "Could not accept a connection\n");
+            return;
+        }
+
+        fflush(stdout);
+        pid_t handler = fork();
+        if (handler == 0) {
+            close(listen_fd);
+            serve_coordinator(connection_fd);
+            _exit(EXIT_SUCCESS);
+        }
+        close(connection_fd);
+
+        // Reap finished handlers without blocking
+        while (waitpid(-1, NULL, WNOHANG) > 0) {
+        }
+    }
+}
+
+/**
+ * Coordinator mode: transpiles the program once, then ships the generated C and one job per
+ * argument set read from stdin to the worker hosts. Each host has one job in flight at a time,
+ * so faster hosts take more work. Outputs are printed in input order as soon as they are
+ * contiguous. With local_workers > 0, that many workers are started on loopback ports instead.
+ * @param ml_filename - Path to the ml file.
+ * @param host_list - Comma-separated "host:port" list (ignored with local workers).
+ * @param local_workers - Number of loopback workers to start, or 0.
+ * @return - EXIT_SUCCESS if every job succeeded, EXIT_FAILURE otherwise.
+ */
+int run_coordinator(const char *ml_filename, const char *host_list, int local_workers) {
+    signal(SIGPIPE, SIG_IGN);  // A lost host shows up as a write error, not a signal
+
+    if (transpile_ml_file(ml_filename) != EXIT_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+
+    // Read the generated program and clean up its local copy
+    pid_t pid = getpid();
+    char c_filename[64];
+    snprintf(c_filename, sizeof(c_filename), "ml_%d.c", pid);
+    FILE *c_file = fopen(c_filename, "r");
+    if (!c_file) {
+        error_log("FILE", "Could not read %s\n", c_filename);
+        return EXIT_FAILURE;
+    }
+    fseek(c_file, 0, SEEK_END);
+    size_t source_length = ftell(c_file);
+    rewind(c_file);
+    char *source = malloc(source_length);
+    source_length = source ? fread(source, 1, source_length, c_file) : 0;
+    fclose(c_file);
+    remove(c_filename);
+
+    // Read the argument sets
+    RemoteJob *jobs = NULL;
+    long job_count = 0;
+    long job_capacity = 0;
+    char line[MAX_LINE_LENGTH];
+    while (fgets(line, sizeof(line), stdin)) {
+        line[strcspn(line, "\n")] = '\0';
+        if (job_count == job_capacity) {
+            job_capacity = job_capacity ? job_capacity * 2 : 64;
+            jobs = realloc(jobs, job_capacity * sizeof(RemoteJob));
+        }
+        memset(&jobs[job_count], 0, sizeof(RemoteJob));
+        snprintf(jobs[job_count].args, sizeof(jobs[job_count].args), "%s", line);
+        job_count++;
+    }
+
+    // Start loopback workers, or connect to the listed hosts
+    int host_fds[MAX_HOSTS];
+    pid_t local_pids[MAX_HOSTS];
+    int host_count = 0;
+    if (local_workers > 0) {
+        for (int i = 0; i < local_workers && i < MAX_HOSTS; i++) {
+            int port = 0;
+            int listen_fd = open_listener("127.0.0.1", &port);
+            if (listen_fd < 0) {
+                error_log("FILE", "Could not open a loopback listener\n");
+                break;
+            }
+            fflush(stdout);
+            local_pids[host_count] = fork();
+            if (local_pids[host_count] == 0) {
+                serve_connections(listen_fd);
+                _exit(EXIT_FAILURE);
+            }
+            close(listen_fd);
+
+            char host_spec[64];
+            snprintf(host_spec, sizeof(host_spec), "127.0.0.1:%d", port);
+            debug_log("INFO", "Started loopback worker %d on %s\n", (int)local_pids[host_count], host_spec);
+            host_fds[host_count++] = connect_to_host(host_spec);
+        }
+    } else {
+        char hosts[1024];
+        snprintf(hosts, sizeof(hosts), "%s", host_list);
+        for (char *host = strtok(hosts, ","); host && host_count < MAX_HOSTS; host = strtok(NULL, ",")) {
+            host_fds[host_count++] = connect_to_host(host);
+        }
+    }
+
+    // Ship the program to every reachable host
+    long in_flight[MAX_HOSTS];
+    int live_hosts = 0;
+    for (int i = 0; i < host_count; i++) {
+        in_flight[i] = -1;
+        if (host_fds[i] < 0) continue;
+        char header[64];
+        int header_length = snprintf(header, sizeof(header), "PROGRAM %zu\n", source_length);
+        if (write_all(host_fds[i], header, header_length) && write_all(host_fds[i], source, source_length)) {
+            live_hosts++;
+        } else {
+            close(host_fds[i]);
+            host_fds[i] = -1;
+        }
+    }
+    free(source);
+
+    long next_job = 0;
+    long next_to_print = 0;
+    long *requeued = malloc((job_count + 1) * sizeof(long));
+    long requeued_count = 0;
+    int result = EXIT_SUCCESS;
+
+    while (next_to_print < job_count && live_hosts > 0) {
+        // Hand a job to every idle host
+        for (int i = 0; i < host_count; i++) {
+            if (host_fds[i] < 0 || in_flight[i] >= 0) continue;
+            long job = requeued_count > 0 ? requeued[--requeued_count] : (next_job < job_count ? next_job++ : -1);
+            if (job < 0) break;
+
+            char args[MAX_LINE_LENGTH];
+            char *job_argv[MAX_IDENTIFIERS];
+            int job_argc = 0;
+            snprintf(args, sizeof(args), "%s", jobs[job].args);
+            for (char *arg = strtok(args, " \t"); arg && job_argc < MAX_IDENTIFIERS; arg = strtok(NULL, " \t")) {
+                job_argv[job_argc++] = arg;
+            }
+
+            char request[MAX_LINE_LENGTH * 2];
+            int request_length = snprintf(request, sizeof(request), "JOB %ld %d\n", job, job_argc);
+            int sent = write_all(host_fds[i], request, request_length);
+            for (int a = 0; a < job_argc && sent; a++) {
+                sent = write_all(host_fds[i], job_argv[a], strlen(job_argv[a])) && write_all(host_fds[i], "\n", 1);
+            }
+            if (sent) {
+                in_flight[i] = job;
+            } else {
+                requeued[requeued_count++] = job;
+                close(host_fds[i]);
+                host_fds[i] = -1;
+                live_hosts--;
+            }
+        }
+
+        // Wait for results
+        struct pollfd watches[MAX_HOSTS];
+        for (int i = 0; i < host_count; i++) {
+            watches[i].fd = in_flight[i] >= 0 ? host_fds[i] : -1;
+            watches[i].events = POLLIN;
+            watches[i].revents = 0;
+        }
+        if (poll(watches, host_count, -1) < 0 && errno != EINTR) {
+            break;
+        }
+
+        for (int i = 0; i < host_count; i++) {
+            if (watches[i].fd < 0 || !(watches[i].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+
+            char header[MAX_LINE_LENGTH];
+            long job_id;
+            int status;
+            size_t output_length;
+            int received = read_line(host_fds[i], header, sizeof(header)) &&
+                           sscanf(header, "RESULT %ld %d %zu", &job_id, &status, &output_length) == 3 &&
+                           job_id == in_flight[i];
+            char *output = received ? malloc(output_length + 1) : NULL;
+            if (received && (!output || !read_exact(host_fds[i], output, output_length))) {
+                received = 0;
+            }
+
+            if (!received) {
+                // Lost the host: give its job to another one
+                free(output);
+                requeued[requeued_count++] = in_flight[i];
+                close(host_fds[i]);
+                host_fds[i] = -1;
+                live_hosts--;
+            } else {
+                jobs[job_id].output = output;
+                jobs[job_id].output_length = output_length;
+                jobs[job_id].status = status;
+                jobs[job_id].done = 1;
+            }
+            in_flight[i] = -1;
+        }
+
+        // Stream results in input order
+        while (next_to_print < job_count && jobs[next_to_print].done) {
+            fwrite(jobs[next_to_print].output, 1, jobs[next_to_print].output_length, stdout);
+            if (jobs[next_to_print].status != EXIT_SUCCESS) {
+                error_log("FILE", "Job %ld (%s) failed\n", next_to_print, jobs[next_to_print].args);
+                result = EXIT_FAILURE;
+            }
+            free(jobs[next_to_print].output);
+            next_to_print++;
+        }
+        fflush(stdout);
+    }
+
+    if (next_to_print < job_count) {
+        error_log("FILE", "No worker hosts left; %ld job(s) not run\n", job_count - next_to_print);
+        result = EXIT_FAILURE;
+    }
+
+    for (int i = 0; i < host_count; i++) {
+        if (host_fds[i] >= 0) close(host_fds[i]);
+    }
+    for (int i = 0; i < host_count && local_workers > 0; i++) {
+        kill(local_pids[i], SIGTERM);
+        waitpid(local_pids[i], NULL, 0);
+    }
+    free(requeued);
+    free(jobs);
+    return result;
+}
+
+/**
+ * Main function of the runml transpiler.
+ * Parses command-line arguments and controls the overall process.
+ * Options come before the ml file; everything after it is passed to the program,
+ * except a trailing -v which is still accepted for verbose mode.
+ */
+int main(int argc, char *argv[]) {
+    int arg_index = 1;
+    const char *spool_directory = NULL;
+    const char *serve_address = NULL;
+    const char *host_list = NULL;
+    int local_workers = 0;
+    int precompile = 0;
+    int check = 0;
+    const char *emit_filename = NULL;
+    int compare = 0;
+    int bench_runs = 0;
+    double precision_tolerance = -1;
+
+    // Parse options preceding the ml file
+    while (arg_index < argc && argv[arg_index][0] == '-') {
+        if (strcmp(argv[arg_index], "-v") == 0) {
+            verbose = 1;
+        } else if (strcmp(argv[arg_index], "-z") == 0 || strcmp(argv[arg_index], "--zygote") == 0) {
+            zygote_mode = 1;
+        } else if (strcmp(argv[arg_index], "-r") == 0 || strcmp(argv[arg_index], "--cache-results") == 0) {
+            cache_results = 1;
+        } else if (strcmp(argv[arg_index], "-c") == 0 || strcmp(argv[arg_index], "--cache-binaries") == 0) {
+            cache_binaries = 1;
+        } else if (strcmp(argv[arg_index], "--worker") == 0 && arg_index + 1 < argc) {
+            spool_directory = argv[++arg_index];
+        } else if (strcmp(argv[arg_index], "--units") == 0 && arg_index + 1 < argc && atoi(argv[arg_index + 1]) > 0) {
+            requested_units = atoi(argv[++arg_index]);
+        } else if (strcmp(argv[arg_index], "--emit-c") == 0 && arg_index + 1 < argc) {
+            emit_filename = argv[++arg_index];
+        } else if (strcmp(argv[arg_index], "--bench") == 0 && arg_index + 1 < argc && atoi(argv[arg_index + 1]) > 0) {
+            bench_runs = atoi(argv[++arg_index]);
+        } else if (strcmp(argv[arg_index], "--line-counts") == 0) {
+            line_counts = 1;
+        } else if (strcmp(argv[arg_index], "--multiversion") == 0) {
+            multiversion = 1;
+        } else if (strcmp(argv[arg_index], "--compile-report") == 0) {
+            compile_report = 1;
+        } else if (strcmp(argv[arg_index], "--opt-report") == 0) {
+            opt_report = 1;
+        } else if (strcmp(argv[arg_index], "--precision=f32") == 0 || strcmp(argv[arg_index], "--precision=f64") == 0) {
+            real_type = strcmp(argv[arg_index], "--precision=f32") == 0 ? "float" : "double";
+        } else if (strcmp(argv[arg_index], "--verify-precision") == 0 && arg_index + 1 < argc && atof(argv[arg_index + 1]) >= 0) {
+            precision_tolerance = atof(argv[++arg_index]);
+        } else if (strcmp(argv[arg_index], "--no-specialize") == 0) {
+            specialize_calls = 0;
+        } else if (strcmp(argv[arg_index], "--specialize-args") == 0) {
+            specialize_arguments = 1;
+            cache_binaries = 1;  // Variants are only worth compiling if they are kept
+        } else if (strcmp(argv[arg_index], "--compare") == 0) {
+            compare = 1;
+        } else if (strcmp(argv[arg_index], "--precompile") == 0) {
+            precompile = 1;
+        } else if (strcmp(argv[arg_index], "--check") == 0) {
+            check = 1;
+        } else if (strcmp(argv[arg_index], "--serve") == 0 && arg_index + 1 < argc) {
+            serve_address = argv[++arg_index];
+        } else if (strcmp(argv[arg_index], "--hosts") == 0 && arg_index + 1 < argc) {
+            host_list = argv[++arg_index];
+        } else if (strcmp(argv[arg_index], "--local-workers") == 0 && arg_index + 1 < argc && atoi(argv[arg_index + 1]) > 0) {
+            local_workers = atoi(argv[++arg_index]);
+        } else if (strcmp(argv[arg_index], "--rows") == 0) {
+            row_input = 1;
+        } else if (strcmp(argv[arg_index], "--trials") == 0 && arg_index + 1 < argc && strtoull(argv[arg_index + 1], NULL, 10) > 0) {
+            trial_count = strtoull(argv[++arg_index], NULL, 10);
+        } else if (strcmp(argv[arg_index], "--seed") == 0 && arg_index + 1 < argc) {
+            setenv("RUNML_SEED", argv[++arg_index], 1);  // Read by the compiled program
+        } else if (strcmp(argv[arg_index], "-j") == 0 && arg_index + 1 < argc && atoi(argv[arg_index + 1]) > 0) {
+            worker_count = atoi(argv[++arg_index]);
+        } else {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+        arg_index++;
+    }
+
+    if (spool_directory) {
+        return run_worker(spool_directory);
+    }
+
+    if (serve_address) {
+        // [address:]port; loopback unless an address is given, since workers run any program sent to them
+        char address[64] = "127.0.0.1";
+        const char *colon = strrchr(serve_address, ':');
+        if (colon) {
+            snprintf(address, sizeof(address), "%.*s", (int)(colon - serve_address), serve_address);
+        }
+        int port = atoi(colon ? colon + 1 : serve_address);
+        int listen_fd = open_listener(address, &port);
+        if (listen_fd < 0) {
+            error_log("FILE", "Could not listen on %s\n", serve_address);
+            return EXIT_FAILURE;
+        }
+        debug_log("INFO", "Serving on %s:%d\n", address, port);
+        serve_connections(listen_fd);
+        return EXIT_FAILURE;
+    }
+
+    if (arg_index >= argc) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (precompile) {
+        return run_precompile(argc - arg_index, argv + arg_index);
+    }
+
+    if (check) {
+        return run_check(argc - arg_index, argv + arg_index);
+    }
+
+    const char *ml_filename = argv[arg_index++];
+
+    // Remaining arguments belong to the ml program; a trailing -v enables verbose mode
+    int program_argc = argc - arg_index;
+    char **program_argv = argv + arg_index;
+    if (program_argc > 0 && strcmp(program_argv[program_argc - 1], "-v") == 0) {
+        verbose = 1;
+        program_argc--;
+    }
+
+    if (verbose) {
+        debug_log("INFO", "Verbose mode enabled\n");
+    }
+
+    if (row_input && (zygote_mode || host_list || local_workers > 0)) {
+        error_log("FILE", "--rows reads the program's input from stdin and cannot be combined with -z or a coordinator\n");
+        return EXIT_FAILURE;
+    }
+    if (line_counts && (trial_count > 0 || host_list || local_workers > 0)) {
+        error_log("FILE", "--line-counts cannot be combined with --trials or a coordinator, which run the program in several places\n");
+        return EXIT_FAILURE;
+    }
+    snprintf(line_counts_path, sizeof(line_counts_path), "%s.lines", ml_filename);
+
+    if (opt_report && (cache_binaries || specialize_arguments || host_list || local_workers > 0)) {
+        error_log("FILE", "--opt-report reads the remarks of a fresh local build and cannot be combined with -c, --specialize-args or a coordinator\n");
+        return EXIT_FAILURE;
+    }
+    if (compile_report && (opt_report || cache_binaries || specialize_arguments || host_list || local_workers > 0)) {
+        error_log("FILE", "--compile-report times a fresh local build in separate units and cannot be combined with --opt-report, -c, --specialize-args or a coordinator\n");
+        return EXIT_FAILURE;
+    }
+    snprintf(opt_report_path, sizeof(opt_report_path), "%s.opt", ml_filename);
+    size_t mapped_length = 0;
+    for (const char *c = ml_filename; *c && mapped_length + 2 < sizeof(mapped_source_name); c++) {
+        if (*c == '"' || *c == '\\') mapped_source_name[mapped_length++] = '\\';
+        mapped_source_name[mapped_length++] = *c;
+    }
+    mapped_source_name[mapped_length] = '\0';
+
+    if (specialize_arguments && (row_input || zygote_mode || host_list || local_workers > 0)) {
+        error_log("FILE", "--specialize-args needs the arguments on the command line and cannot be combined with --rows, -z or a coordinator\n");
+        return EXIT_FAILURE;
+    }
+
+    if (trial_count > 0 && (row_input || zygote_mode || host_list || local_workers > 0)) {
+        error_log("FILE", "--trials cannot be combined with --rows, -z or a coordinator\n");
+        return EXIT_FAILURE;
+    }
+
+    if (emit_filename) {
+        return emit_c_program(ml_filename, emit_filename);
+    }
+
+    if (compare) {
+        if (row_input || trial_count > 0 || zygote_mode || cache_binaries || cache_results || host_list || local_workers > 0) {
+            error_log("FILE", "--compare runs every engine itself and cannot be combined with other run modes\n");
+            return EXIT_FAILURE;
+        }
+        return run_comparison(ml_filename, program_argc, program_argv);
+    }
+
+    if (precision_tolerance >= 0) {
+        if (row_input || trial_count > 0 || zygote_mode || host_list || local_workers > 0) {
+            error_log("FILE", "--verify-precision runs the program itself and cannot be combined with other run modes\n");
+            return EXIT_FAILURE;
+        }
+        return run_precision_check(ml_filename, program_argc, program_argv, precision_tolerance);
+    }
+
+    if (bench_runs > 0) {
+        if (row_input || zygote_mode || host_list || local_workers > 0) {
+            error_log("FILE", "--bench cannot be combined with --rows, -z or a coordinator, which read stdin\n");
+            return EXIT_FAILURE;
+        }
+        return run_benchmark(ml_filename, program_argc, program_argv, bench_runs);
+    }
+
+    if (host_list || local_workers > 0) {
+        return run_coordinator(ml_filename, host_list, local_workers);
+    }
+
+    return run_ml_file(ml_filename, program_argc, program_argv, NULL);
+}
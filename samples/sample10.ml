@@ -0,0 +1,12 @@
+# 285 is printed
+#
+function sq x
+	return x * x
+#
+total <- 0
+#
+function sq2 x
+	return sq(x)
+parallel repeat 10 i sum total
+	total <- sq2(i)
+print total
@@ -0,0 +1,50 @@
+#!/bin/sh
+# Checks that runml --check reports the programs in tests/check/ as invalid.
+# Each of them is rejected by the C compiler, so an "ok" there is a false pass.
+# The first line of each file is "# expect: <text>", and the diagnostic printed
+# for the file must contain that text. The samples must all check without errors,
+# except sample09, which calls print as a function.
+#
+# Usage: tests/check.sh
+# Environment:
+#   CC            C compiler (default cc)
+
+set -e
+cd "$(dirname "$0")/.."
+
+CC=${CC:-cc}
+
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+$CC -std=c11 -Wall -Werror -o "$work/runml" runml.c -lm -lpthread -ldl
+
+failures=0
+for program in tests/check/*.ml; do
+    expected=$(sed -n '1s/^# expect: //p' "$program")
+    if "$work/runml" --check "$program" >"$work/out" 2>"$work/err"; then
+        echo "FAIL $program: --check reported ok"
+        failures=$((failures + 1))
+    elif ! grep -qF "$expected" "$work/err"; then
+        echo "FAIL $program: expected \"$expected\", got:"
+        cat "$work/err"
+        failures=$((failures + 1))
+    else
+        echo "ok   $program"
+    fi
+done
+
+for program in samples/*.ml; do
+    [ "$program" = samples/sample09.ml ] && continue
+    if ! "$work/runml" --check "$program" >"$work/out" 2>"$work/err"; then
+        echo "FAIL $program: valid sample rejected:"
+        cat "$work/err"
+        failures=$((failures + 1))
+    fi
+done
+
+if [ "$failures" -ne 0 ]; then
+    echo "$failures check test(s) failed"
+    exit 1
+fi
+echo "all check tests passed"
@@ -0,0 +1,3 @@
+# expect: Expected an operand before '*'
+x <- 1
+print x * * 3
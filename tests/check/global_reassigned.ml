@@ -0,0 +1,4 @@
+# expect: Global variable x is assigned more than once
+x <- 1
+x <- 2
+print x
@@ -0,0 +1,3 @@
+# expect: Expression ends without an operand
+x <- 1
+print x +